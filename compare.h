@@ -0,0 +1,70 @@
+#ifndef LAB0_COMPARE_H
+#define LAB0_COMPARE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* String comparison for the hot loops of sorting, merging and checking.
+ *
+ * Being inline, these are specialized at every call site, and a call with a
+ * constant order reduces to a single test of the result.  Most strings that
+ * differ already do so in their first byte, which is checked without calling
+ * into the C library.
+ */
+
+/* Compare a and b like strcmp */
+static inline int str_cmp(const char *a, const char *b)
+{
+    unsigned char ca = *a, cb = *b;
+    if (ca != cb)
+        return ca - cb;
+    return ca ? strcmp(a + 1, b + 1) : 0;
+}
+
+static inline bool str_eq(const char *a, const char *b)
+{
+    return *a == *b && !strcmp(a, b);
+}
+
+/* Key prefix: the first 8 bytes of s as big-endian integer, zero padded.
+ * Prefixes order like the strings they come from, so that strings are only
+ * looked at when their prefixes tie.
+ */
+static inline uint64_t str_prefix(const char *s)
+{
+    uint64_t p = 0;
+    for (int i = 0; i < 8; i++) {
+        p <<= 8;
+        if (*s)
+            p |= (unsigned char) *s++;
+    }
+    return p;
+}
+
+/* Compare strings a and b, given their key prefixes, like strcmp */
+static inline int key_cmp(uint64_t pa,
+                          const char *a,
+                          uint64_t pb,
+                          const char *b)
+{
+    if (pa != pb)
+        return pa < pb ? -1 : 1;
+    /* Equal prefixes ending in a zero byte cover both strings entirely */
+    if (!(pa & 0xff))
+        return 0;
+    return strcmp(a + 8, b + 8);
+}
+
+/* Whether key a has to come after key b, in ascending or descending order */
+static inline bool key_after(uint64_t pa,
+                             const char *a,
+                             uint64_t pb,
+                             const char *b,
+                             bool descend)
+{
+    int c = key_cmp(pa, a, pb, b);
+    return descend ? c < 0 : c > 0;
+}
+
+#endif /* LAB0_COMPARE_H */
@@ -4,6 +4,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +21,13 @@ int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+
+/* Commands and parameters are also hashed by name, so that looking one up
+ * does not walk the alphabetical lists.
+ */
+#define HASH_BUCKETS 64
+static cmd_element_t *cmd_table[HASH_BUCKETS];
+static param_element_t *param_table[HASH_BUCKETS];
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -64,6 +72,7 @@ static bool has_infile = false;
 #define MAXQUIT 10
 static cmd_func_t quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
+static step_func_t step_helper = NULL;
 
 static void init_in();
 
@@ -72,6 +81,17 @@ static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+static void record_stop();
+
+static uint32_t str_hash(const char *s)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    while (*s)
+        h = (h ^ (uint8_t) *s++) * 16777619u;
+    return h;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -87,8 +107,13 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    cmd->simulate = NULL;
     cmd->next = next_cmd;
     *last_loc = cmd;
+
+    uint32_t h = str_hash(name) & (HASH_BUCKETS - 1);
+    cmd->hnext = cmd_table[h];
+    cmd_table[h] = cmd;
 }
 
 /* Add a new parameter */
@@ -109,25 +134,39 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+
+    uint32_t h = str_hash(name) & (HASH_BUCKETS - 1);
+    param->hnext = param_table[h];
+    param_table[h] = param;
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Storage reused by parse_args, grown on demand */
+static char *arg_buf = NULL;
+static size_t arg_buf_size = 0;
+static char **arg_vec = NULL;
+static size_t arg_vec_size = 0;
+
+/* Parse a string into a command line.
+ * Words are copied into a buffer reused across calls and the returned array
+ * points into it, so nothing is allocated per command and the caller frees
+ * nothing.  The result is only valid until the next call, or free_args().
+ */
+static char **parse_args(const char *line, int *argcp)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
     size_t len = strlen(line);
+    if (len + 1 > arg_buf_size) {
+        if (arg_buf)
+            free_block(arg_buf, arg_buf_size);
+        arg_buf_size = len + 1 > RIO_BUFSIZE ? len + 1 : RIO_BUFSIZE;
+        arg_buf = malloc_or_fail(arg_buf_size, "parse_args");
+    }
 
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-
-    char *src = line;
-    char *dst = buf;
+    /* Copy into buffer with each word null-terminated */
+    const char *src = line;
+    char *dst = arg_buf;
     bool skipping = true;
     int c;
-    int argc = 0;
+    size_t argc = 0;
     while ((c = *src++) != '\0') {
         if (isspace(c)) {
             if (!skipping) {
@@ -138,26 +177,40 @@ static char **parse_args(char *line, int *argcp)
         } else {
             if (skipping) {
                 /* Hit start of new word */
-                argc++;
+                if (argc == arg_vec_size) {
+                    size_t size = arg_vec_size ? arg_vec_size * 2 : 16;
+                    char **vec =
+                        calloc_or_fail(size, sizeof(char *), "parse_args");
+                    if (arg_vec) {
+                        memcpy(vec, arg_vec, arg_vec_size * sizeof(char *));
+                        free_array(arg_vec, arg_vec_size, sizeof(char *));
+                    }
+                    arg_vec = vec;
+                    arg_vec_size = size;
+                }
+                arg_vec[argc++] = dst;
                 skipping = false;
             }
             *dst++ = c;
         }
     }
     /* Let the last substring is null-terminated */
-    *dst++ = '\0';
-
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
-    }
+    *dst = '\0';
 
-    free_block(buf, len + 1);
     *argcp = argc;
-    return argv;
+    return arg_vec;
+}
+
+/* Release the storage of parse_args, invalidating the last command line */
+static void free_args()
+{
+    if (arg_buf)
+        free_block(arg_buf, arg_buf_size);
+    if (arg_vec)
+        free_array(arg_vec, arg_vec_size, sizeof(char *));
+    arg_buf = NULL;
+    arg_vec = NULL;
+    arg_buf_size = arg_vec_size = 0;
 }
 
 /* Handles forced console termination for record_error and do_quit */
@@ -177,14 +230,26 @@ static bool force_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    cmd_list = NULL;
+    param_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
 
     while (buf_stack)
         pop_file();
 
+    record_stop();
+
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
 
+    /* Deliver output of the quit command itself before closing */
+    web_close();
+
+    /* Last use of argv, which points into the parse_args storage */
+    free_args();
+
     quit_flag = true;
     return ok;
 }
@@ -200,18 +265,58 @@ static void record_error()
     }
 }
 
+/* Find command by name, NULL if there is no such command */
+static cmd_element_t *find_cmd(const char *name)
+{
+    cmd_element_t *next_cmd = cmd_table[str_hash(name) & (HASH_BUCKETS - 1)];
+    while (next_cmd && strcmp(name, next_cmd->name) != 0)
+        next_cmd = next_cmd->hnext;
+    return next_cmd;
+}
+
+/* Find parameter by name, NULL if there is no such parameter */
+static param_element_t *find_param(const char *name)
+{
+    param_element_t *next_param =
+        param_table[str_hash(name) & (HASH_BUCKETS - 1)];
+    while (next_param && strcmp(name, next_param->name) != 0)
+        next_param = next_param->hnext;
+    return next_param;
+}
+
+/* Set the operation of command name in simulation mode, adding the command
+ * if there is none of that name yet
+ */
+void add_sim_cmd(char *name, cmd_func_t operation, char *summary)
+{
+    cmd_element_t *cmd = find_cmd(name);
+    if (!cmd) {
+        add_cmd(name, operation, summary, "");
+        cmd = find_cmd(name);
+    }
+    cmd->simulate = operation;
+}
+
+/* Run a command, through its simulation mode operation if it has one and
+ * simulation mode is on
+ */
+static bool run_cmd(const cmd_element_t *cmd, int argc, char *argv[])
+{
+    if (simulation && cmd->simulate)
+        return cmd->simulate(argc, argv);
+    return cmd->operation(argc, argv);
+}
+
 /* Execute a command that has already been split into arguments */
 static bool interpret_cmda(int argc, char *argv[])
 {
     if (argc == 0)
         return true;
     /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
+    cmd_element_t *next_cmd = find_cmd(argv[0]);
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
     if (next_cmd) {
-        ok = next_cmd->operation(argc, argv);
+        ok = run_cmd(next_cmd, argc, argv);
         if (!ok)
             record_error();
     } else {
@@ -223,20 +328,42 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
+static void record_cmd(int argc, char *argv[]);
+
 /* Execute a command from a command line */
 static bool interpret_cmd(char *cmdline)
 {
     if (quit_flag)
         return false;
 
+    if (step_helper)
+        step_helper();
+
     int argc;
     char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
+    record_cmd(argc, argv);
+    return interpret_cmda(argc, argv);
+}
 
-    return ok;
+void set_step_helper(step_func_t fn)
+{
+    step_helper = fn;
+}
+
+/* Spend the time spent waiting for input on fd on deferred work */
+static void run_idle(int fd)
+{
+    if (!step_helper)
+        return;
+
+    do {
+        fd_set readfds;
+        struct timeval tv = {0, 0};
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+        if (select(fd + 1, &readfds, NULL, NULL, &tv) != 0)
+            return;
+    } while (step_helper());
 }
 
 /* Set function to be executed as part of program exit */
@@ -330,17 +457,14 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
+        /* Find parameter in table */
+        param_element_t *plist = find_param(name);
+        if (plist) {
+            int oldval = *plist->valp;
+            *plist->valp = value;
+            if (plist->setter)
+                plist->setter(oldval);
+            found = true;
         }
         /* Didn't find parameter */
         if (!found) {
@@ -425,11 +549,376 @@ static bool do_web(int argc, char *argv[])
     return true;
 }
 
+/* Binary traces.
+ *
+ * The "record" command captures every interpreted command into a compact
+ * operation log, which "replay" executes without any text parsing.  All
+ * integers are stored in host byte order:
+ *
+ *   header:   "QTR1"
+ *   REC_CMD:  u8 tag, u16 length, name with NUL   -> next command index
+ *   REC_STR:  u8 tag, u16 length, string with NUL -> next string index
+ *   REC_OP:   u8 tag, u16 command, u8 nargs, u32 repeat, u32 string[nargs]
+ *
+ * Consecutive identical commands are collapsed into a single REC_OP whose
+ * repeat field counts them.
+ */
+#define TRACE_MAGIC "QTR1"
+#define TRACE_MAX_ARGS 255
+
+enum { REC_CMD = 1, REC_STR, REC_OP };
+
+static struct {
+    FILE *fp;
+    /* Commands defined so far, index is the opcode */
+    cmd_element_t **cmds;
+    size_t ncmds, cmd_cap;
+    /* Interned argument strings and open addressing table of (index + 1) */
+    char **strs;
+    uint32_t nstrs, str_cap;
+    uint32_t *slots;
+    uint32_t nslots;
+    /* Last operation, held back so that repetitions can be merged */
+    bool pending;
+    uint16_t op_cmd;
+    uint8_t op_nargs;
+    uint32_t op_repeat;
+    uint32_t op_args[TRACE_MAX_ARGS];
+} rec;
+
+static bool do_source(int argc, char *argv[]);
+static bool do_record(int argc, char *argv[]);
+static bool do_replay(int argc, char *argv[]);
+
+/* Grow array p of cap elements of size bytes to twice its capacity */
+static void *grow_array(void *p, size_t cap, size_t bytes)
+{
+    void *np = calloc_or_fail(cap ? cap * 2 : 16, bytes, "grow_array");
+    if (p) {
+        memcpy(np, p, cap * bytes);
+        free_array(p, cap, bytes);
+    }
+    return np;
+}
+
+static void trace_put_def(uint8_t tag, const char *s)
+{
+    uint16_t len = strlen(s) + 1;
+    fwrite(&tag, sizeof(tag), 1, rec.fp);
+    fwrite(&len, sizeof(len), 1, rec.fp);
+    fwrite(s, 1, len, rec.fp);
+}
+
+static void trace_flush_op()
+{
+    if (!rec.pending)
+        return;
+
+    uint8_t tag = REC_OP;
+    fwrite(&tag, sizeof(tag), 1, rec.fp);
+    fwrite(&rec.op_cmd, sizeof(rec.op_cmd), 1, rec.fp);
+    fwrite(&rec.op_nargs, sizeof(rec.op_nargs), 1, rec.fp);
+    fwrite(&rec.op_repeat, sizeof(rec.op_repeat), 1, rec.fp);
+    fwrite(rec.op_args, sizeof(uint32_t), rec.op_nargs, rec.fp);
+    rec.pending = false;
+}
+
+/* Return opcode of command, defining it in the trace on first use */
+static uint16_t trace_cmd_index(cmd_element_t *cmd)
+{
+    for (size_t i = 0; i < rec.ncmds; i++) {
+        if (rec.cmds[i] == cmd)
+            return i;
+    }
+
+    if (rec.ncmds == rec.cmd_cap) {
+        rec.cmds = grow_array(rec.cmds, rec.cmd_cap, sizeof(*rec.cmds));
+        rec.cmd_cap = rec.cmd_cap ? rec.cmd_cap * 2 : 16;
+    }
+    trace_flush_op();
+    trace_put_def(REC_CMD, cmd->name);
+    rec.cmds[rec.ncmds] = cmd;
+    return rec.ncmds++;
+}
+
+/* Return reference of string, defining it in the trace on first use */
+static uint32_t trace_str_index(const char *s)
+{
+    if (rec.nstrs * 2 >= rec.nslots) {
+        /* Rehash into a table twice as large */
+        uint32_t nslots = rec.nslots ? rec.nslots * 2 : 64;
+        uint32_t *slots = calloc_or_fail(nslots, sizeof(uint32_t), "record");
+        for (uint32_t i = 0; i < rec.nstrs; i++) {
+            uint32_t h = str_hash(rec.strs[i]) & (nslots - 1);
+            while (slots[h])
+                h = (h + 1) & (nslots - 1);
+            slots[h] = i + 1;
+        }
+        if (rec.slots)
+            free_array(rec.slots, rec.nslots, sizeof(uint32_t));
+        rec.slots = slots;
+        rec.nslots = nslots;
+    }
+
+    uint32_t h = str_hash(s) & (rec.nslots - 1);
+    while (rec.slots[h]) {
+        if (!strcmp(rec.strs[rec.slots[h] - 1], s))
+            return rec.slots[h] - 1;
+        h = (h + 1) & (rec.nslots - 1);
+    }
+
+    if (rec.nstrs == rec.str_cap) {
+        rec.strs = grow_array(rec.strs, rec.str_cap, sizeof(*rec.strs));
+        rec.str_cap = rec.str_cap ? rec.str_cap * 2 : 16;
+    }
+    trace_flush_op();
+    trace_put_def(REC_STR, s);
+    rec.strs[rec.nstrs] = strsave_or_fail(s, "record");
+    rec.slots[h] = rec.nstrs + 1;
+    return rec.nstrs++;
+}
+
+/* Append command to the trace being recorded */
+static void record_cmd(int argc, char *argv[])
+{
+    if (!rec.fp || argc == 0)
+        return;
+
+    cmd_element_t *cmd = find_cmd(argv[0]);
+    /* Commands that only steer the input are not part of the session */
+    if (!cmd || cmd->operation == do_source || cmd->operation == do_record ||
+        cmd->operation == do_replay)
+        return;
+
+    if (argc - 1 > TRACE_MAX_ARGS) {
+        report(1, "Warning: '%s' has too many arguments to be recorded",
+               argv[0]);
+        return;
+    }
+
+    uint32_t args[TRACE_MAX_ARGS];
+    uint16_t op = trace_cmd_index(cmd);
+    for (int i = 1; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        if (len > UINT16_MAX - 1) {
+            report(1, "Warning: argument of '%s' is too long to be recorded",
+                   argv[0]);
+            return;
+        }
+        args[i - 1] = trace_str_index(argv[i]);
+    }
+
+    uint8_t nargs = argc - 1;
+    if (rec.pending && rec.op_cmd == op && rec.op_nargs == nargs &&
+        rec.op_repeat < UINT32_MAX &&
+        !memcmp(rec.op_args, args, nargs * sizeof(uint32_t))) {
+        rec.op_repeat++;
+        return;
+    }
+
+    trace_flush_op();
+    rec.pending = true;
+    rec.op_cmd = op;
+    rec.op_nargs = nargs;
+    rec.op_repeat = 1;
+    memcpy(rec.op_args, args, nargs * sizeof(uint32_t));
+}
+
+/* Finish the trace being recorded, if any */
+static void record_stop()
+{
+    if (!rec.fp)
+        return;
+
+    trace_flush_op();
+    fclose(rec.fp);
+    rec.fp = NULL;
+
+    for (uint32_t i = 0; i < rec.nstrs; i++)
+        free_string(rec.strs[i]);
+    if (rec.strs)
+        free_array(rec.strs, rec.str_cap, sizeof(*rec.strs));
+    if (rec.slots)
+        free_array(rec.slots, rec.nslots, sizeof(uint32_t));
+    if (rec.cmds)
+        free_array(rec.cmds, rec.cmd_cap, sizeof(*rec.cmds));
+    memset(&rec, 0, sizeof(rec));
+}
+
+static bool do_record(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    record_stop();
+    if (argc == 1)
+        return true;
+
+    rec.fp = fopen(argv[1], "wb");
+    if (!rec.fp) {
+        report(1, "Couldn't open trace file '%s'", argv[1]);
+        return false;
+    }
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), rec.fp);
+    return true;
+}
+
+/* Load whole file into memory.  Return NULL on failure */
+static char *load_file(const char *fname, size_t *sizep)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    char *buf = malloc_or_fail(size + 1, "load_file");
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n <= 0) {
+            free_block(buf, size + 1);
+            close(fd);
+            return NULL;
+        }
+        done += n;
+    }
+    close(fd);
+
+    *sizep = size;
+    return buf;
+}
+
+/* Execute trace held in buf.  Return false if the trace is malformed */
+static bool replay_trace(char *buf, size_t size)
+{
+    size_t cmd_cap = 0, ncmds = 0, str_cap = 0, nstrs = 0;
+    cmd_element_t **cmds = NULL;
+    char **strs = NULL;
+    char *argv[TRACE_MAX_ARGS + 1];
+    bool ok = true;
+
+    char *p = buf + strlen(TRACE_MAGIC), *end = buf + size;
+    while (ok && !quit_flag && p < end) {
+        uint8_t tag = *p++;
+        if (tag == REC_CMD || tag == REC_STR) {
+            uint16_t len;
+            if (end - p < (ptrdiff_t) sizeof(len)) {
+                ok = false;
+                break;
+            }
+            memcpy(&len, p, sizeof(len));
+            p += sizeof(len);
+            if (!len || end - p < len || p[len - 1] != '\0') {
+                ok = false;
+                break;
+            }
+
+            if (tag == REC_CMD) {
+                cmd_element_t *cmd = find_cmd(p);
+                if (!cmd) {
+                    report(1, "Unknown command '%s' in trace", p);
+                    ok = false;
+                    break;
+                }
+                if (ncmds == cmd_cap) {
+                    cmds = grow_array(cmds, cmd_cap, sizeof(*cmds));
+                    cmd_cap = cmd_cap ? cmd_cap * 2 : 16;
+                }
+                cmds[ncmds++] = cmd;
+            } else {
+                if (nstrs == str_cap) {
+                    strs = grow_array(strs, str_cap, sizeof(*strs));
+                    str_cap = str_cap ? str_cap * 2 : 16;
+                }
+                strs[nstrs++] = p;
+            }
+            p += len;
+        } else if (tag == REC_OP) {
+            uint16_t op;
+            uint8_t nargs;
+            uint32_t repeat, arg;
+            if (end - p < (ptrdiff_t) (sizeof(op) + sizeof(nargs) +
+                                       sizeof(repeat))) {
+                ok = false;
+                break;
+            }
+            memcpy(&op, p, sizeof(op));
+            p += sizeof(op);
+            nargs = *p++;
+            memcpy(&repeat, p, sizeof(repeat));
+            p += sizeof(repeat);
+            if (op >= ncmds || end - p < (ptrdiff_t) (nargs * sizeof(arg))) {
+                ok = false;
+                break;
+            }
+
+            cmd_element_t *cmd = cmds[op];
+            argv[0] = cmd->name;
+            for (int i = 0; i < nargs; i++) {
+                memcpy(&arg, p, sizeof(arg));
+                p += sizeof(arg);
+                if (arg >= nstrs) {
+                    ok = false;
+                    break;
+                }
+                argv[i + 1] = strs[arg];
+            }
+
+            for (uint32_t r = 0; ok && r < repeat && !quit_flag; r++) {
+                if (!run_cmd(cmd, nargs + 1, argv))
+                    record_error();
+            }
+        } else {
+            ok = false;
+        }
+    }
+
+    if (cmds)
+        free_array(cmds, cmd_cap, sizeof(*cmds));
+    if (strs)
+        free_array(strs, str_cap, sizeof(*strs));
+    return ok;
+}
+
+static bool do_replay(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "No trace file given. Use 'replay <file>'.");
+        return false;
+    }
+
+    size_t size;
+    char *buf = load_file(argv[1], &size);
+    if (!buf) {
+        report(1, "Could not read trace file '%s'", argv[1]);
+        return false;
+    }
+
+    bool ok = size >= strlen(TRACE_MAGIC) &&
+              !memcmp(buf, TRACE_MAGIC, strlen(TRACE_MAGIC));
+    ok = ok && replay_trace(buf, size);
+    if (!ok)
+        report(1, "Malformed trace file '%s'", argv[1]);
+
+    free_block(buf, size + 1);
+    return ok;
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
     err_cnt = 0;
     quit_flag = false;
 
@@ -442,6 +931,10 @@ void init_cmd()
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(record,
+                "Record commands into binary trace file. Omit file to stop",
+                "[file]");
+    ADD_COMMAND(replay, "Execute commands from binary trace file", "file");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
@@ -666,7 +1159,10 @@ bool run_console(char *infile_name)
 
     if (!has_infile) {
         char *cmdline;
-        while (use_linenoise && (cmdline = linenoise(prompt))) {
+        while (use_linenoise) {
+            run_idle(STDIN_FILENO);
+            if (!(cmdline = linenoise(prompt)))
+                break;
             interpret_cmd(cmdline);
             line_history_add(cmdline);       /* Add to the history. */
             line_history_save(HISTORY_FILE); /* Save the history on disk. */
@@ -18,13 +18,18 @@ typedef bool (*cmd_func_t)(int argc, char *argv[]);
 
 /* Information about each command */
 
-/* Organized as linked list in alphabetical order */
+/* Organized as linked list in alphabetical order, and chained by hash of the
+ * name for lookup
+ */
 typedef struct __cmd_element {
     char *name;
     cmd_func_t operation;
     char *summary;
     char *param;
+    /* Operation in simulation mode, if any */
+    cmd_func_t simulate;
     struct __cmd_element *next;
+    struct __cmd_element *hnext;
 } cmd_element_t;
 
 /* Optionally supply function that gets invoked when parameter changes */
@@ -38,6 +43,7 @@ typedef struct __param_element {
     /* Function that gets called whenever parameter changes */
     setter_func_t setter;
     struct __param_element *next;
+    struct __param_element *hnext; /* Next in hash chain */
 } param_element_t;
 
 /* Initialize interpreter */
@@ -47,6 +53,11 @@ void init_cmd();
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *parameter);
 #define ADD_COMMAND(cmd, msg, param) add_cmd(#cmd, do_##cmd, msg, param)
 
+/* Set the operation of a command in simulation mode, adding the command if
+ * needed
+ */
+void add_sim_cmd(char *name, cmd_func_t operation, char *summary);
+
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 
@@ -56,6 +67,13 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Set function doing deferred work one bounded step at a time.  It is called
+ * before every command, and repeatedly while waiting for interactive input as
+ * long as it returns true to ask for more.
+ */
+typedef bool (*step_func_t)();
+void set_step_helper(step_func_t fn);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
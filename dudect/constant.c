@@ -1,54 +1,526 @@
+/* sched_setaffinity() and RUSAGE_THREAD are GNU extensions */
+#if defined(__linux__) || defined(__GNU__)
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "constant.h"
 #include "cpucycles.h"
 #include "queue.h"
 #include "random.h"
 
-/* Maintain a queue independent from the qtest since
- * we do not want the test to affect the original functionality
+static char random_string[N_MEASURES][8];
+static int random_string_iter = 0;
+
+static char *get_random_string(void)
+{
+    random_string_iter = (random_string_iter + 1) % N_MEASURES;
+    return random_string[random_string_iter];
+}
+
+static void new_random_strings(void)
+{
+    for (size_t i = 0; i < N_MEASURES; ++i) {
+        /* Generate random string */
+        randombytes((uint8_t *) random_string[i], 7);
+        random_string[i][7] = 0;
+    }
+}
+
+void dut_fill(struct list_head *q, int n)
+{
+    while (n--)
+        q_insert_head(q, get_random_string());
+}
+
+/* Setup and teardown shared by the operations of queue.h */
+
+static void setup_random(dut_input_t *in, int n)
+{
+    in->q = q_new();
+    dut_fill(in->q, n);
+    in->size = n;
+    in->s = get_random_string();
+    in->e = NULL;
+}
+
+/* Sorted queue where every string appears twice, so that the share of
+ * duplicates does not depend on the size
  */
-static struct list_head *l = NULL;
+static void setup_pairs(dut_input_t *in, int n)
+{
+    char buf[16];
 
-#define dut_new() ((void) (l = q_new()))
+    in->q = q_new();
+    for (int i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%08x", i / 2);
+        q_insert_tail(in->q, buf);
+    }
+    in->size = n;
+    in->s = get_random_string();
+    in->e = NULL;
+}
 
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
+static bool release(dut_input_t *in, bool ok)
+{
+    if (in->e)
+        q_release_element(in->e);
+    in->e = NULL;
+    q_free(in->q);
+    return ok;
+}
 
-#define dut_insert_head(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_head(l, s); \
-    } while (0)
+static bool teardown_same(dut_input_t *in)
+{
+    return release(in, q_size(in->q) == in->size);
+}
 
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
+static bool teardown_one_less(dut_input_t *in)
+{
+    return release(in, q_size(in->q) == in->size - 1);
+}
 
-#define dut_free() ((void) (q_free(l)))
+static bool teardown_not_more(dut_input_t *in)
+{
+    return release(in, q_size(in->q) <= in->size);
+}
 
-static char random_string[N_MEASURES][8];
-static int random_string_iter = 0;
+static bool teardown_result(dut_input_t *in)
+{
+    return release(in, in->ret == q_size(in->q));
+}
+
+static bool teardown_sorted(dut_input_t *in)
+{
+    bool ok = q_size(in->q) == in->size;
+    element_t *e;
+    list_for_each_entry (e, in->q, list) {
+        if (e->list.next != in->q &&
+            strcmp(e->value,
+                   list_entry(e->list.next, element_t, list)->value) > 0)
+            ok = false;
+    }
+    return release(in, ok);
+}
+
+/* Insertion and removal, undone after every call */
+
+static void call_insert_head(dut_input_t *in)
+{
+    q_insert_head(in->q, in->s);
+}
+
+static void call_insert_tail(dut_input_t *in)
+{
+    q_insert_tail(in->q, in->s);
+}
+
+static void call_remove_head(dut_input_t *in)
+{
+    in->e = q_remove_head(in->q, NULL, 0);
+}
+
+static void call_remove_tail(dut_input_t *in)
+{
+    in->e = q_remove_tail(in->q, NULL, 0);
+}
+
+/* Undoing must not cost more than the call, so it only checks that the
+ * element went in or out at the right end.  Teardown checks the size.
+ */
+static bool undo_inserted(dut_input_t *in, element_t *e)
+{
+    if (!e)
+        return false;
+    bool ok = !strcmp(e->value, in->s);
+    q_release_element(e);
+    return ok;
+}
+
+static bool undo_insert_head(dut_input_t *in)
+{
+    return undo_inserted(in, q_remove_head(in->q, NULL, 0));
+}
+
+static bool undo_insert_tail(dut_input_t *in)
+{
+    return undo_inserted(in, q_remove_tail(in->q, NULL, 0));
+}
+
+static bool undo_remove_head(dut_input_t *in)
+{
+    if (!in->e)
+        return false;
+    bool ok = q_insert_head(in->q, in->e->value);
+    q_release_element(in->e);
+    in->e = NULL;
+    return ok;
+}
+
+static bool undo_remove_tail(dut_input_t *in)
+{
+    if (!in->e)
+        return false;
+    bool ok = q_insert_tail(in->q, in->e->value);
+    q_release_element(in->e);
+    in->e = NULL;
+    return ok;
+}
+
+/* Operations on the whole queue */
+
+static void call_size(dut_input_t *in)
+{
+    in->ret = q_size(in->q);
+}
+
+static void call_delete_mid(dut_input_t *in)
+{
+    q_delete_mid(in->q);
+}
+
+static void call_delete_dup(dut_input_t *in)
+{
+    q_delete_dup(in->q);
+}
+
+static void call_swap(dut_input_t *in)
+{
+    q_swap(in->q);
+}
+
+static void call_reverse(dut_input_t *in)
+{
+    q_reverse(in->q);
+}
+
+static void call_reverseK(dut_input_t *in)
+{
+    q_reverseK(in->q, 3);
+}
+
+static void call_sort(dut_input_t *in)
+{
+    q_sort(in->q, false);
+}
+
+static void call_ascend(dut_input_t *in)
+{
+    in->ret = q_ascend(in->q);
+}
+
+static void call_descend(dut_input_t *in)
+{
+    in->ret = q_descend(in->q);
+}
+
+/* Merge of two sorted queues of about half the size each */
+static void setup_merge(dut_input_t *in, int n)
+{
+    INIT_LIST_HEAD(&in->chain);
+    for (int i = 0; i < 2; i++) {
+        queue_contex_t *ctx = &in->ctx[i];
+        ctx->q = q_new();
+        ctx->size = i ? n - n / 2 : n / 2;
+        ctx->id = i;
+        dut_fill(ctx->q, ctx->size);
+        q_sort(ctx->q, false);
+        list_add_tail(&ctx->chain, &in->chain);
+    }
+    in->q = in->ctx[0].q;
+    in->size = n;
+    in->e = NULL;
+}
+
+static void call_merge(dut_input_t *in)
+{
+    in->ret = q_merge(&in->chain, false);
+}
+
+static bool teardown_merge(dut_input_t *in)
+{
+    bool ok = in->ret == in->size && q_size(in->ctx[0].q) == in->size &&
+              q_size(in->ctx[1].q) == 0;
+    q_free(in->ctx[1].q);
+    return teardown_sorted(in) && ok;
+}
+
+#define MAX_DUTS 32
+
+static dut_t dut_table[MAX_DUTS] = {
+    {"insert_head", "ih", DUT_CONSTANT, 0, setup_random, call_insert_head,
+     undo_insert_head, teardown_same},
+    {"insert_tail", "it", DUT_CONSTANT, 0, setup_random, call_insert_tail,
+     undo_insert_tail, teardown_same},
+/* FIXME: It is known that both q_remove_tail() and q_remove_head() can not
+ * pass dudect on Apple M1 (based on Arm64).  We shall figure out the exact
+ * reasons and resolve later.
+ */
+#if !(defined(__aarch64__) && defined(__APPLE__))
+    {"remove_head", "rh", DUT_CONSTANT, 1, setup_random, call_remove_head,
+     undo_remove_head, teardown_same},
+    {"remove_tail", "rt", DUT_CONSTANT, 1, setup_random, call_remove_tail,
+     undo_remove_tail, teardown_same},
+#endif
+    {"size", "size", DUT_LINEAR, 0, setup_random, call_size, NULL,
+     teardown_result},
+    {"delete_mid", "dm", DUT_LINEAR, 1, setup_random, call_delete_mid, NULL,
+     teardown_one_less},
+    {"delete_dup", "dedup", DUT_LINEAR, 0, setup_pairs, call_delete_dup, NULL,
+     teardown_not_more},
+    {"swap", "swap", DUT_LINEAR, 0, setup_random, call_swap, NULL,
+     teardown_same},
+    {"reverse", "reverse", DUT_LINEAR, 0, setup_random, call_reverse, NULL,
+     teardown_same},
+    {"reverseK", "reverseK", DUT_LINEAR, 0, setup_random, call_reverseK, NULL,
+     teardown_same},
+    {"sort", "sort", DUT_LINEARITHMIC, 0, setup_random, call_sort, NULL,
+     teardown_sorted},
+    {"ascend", "ascend", DUT_LINEAR, 0, setup_random, call_ascend, NULL,
+     teardown_result},
+    {"descend", "descend", DUT_LINEAR, 0, setup_random, call_descend, NULL,
+     teardown_result},
+    {"merge", "merge", DUT_LINEAR, 0, setup_merge, call_merge, NULL,
+     teardown_merge},
+};
+
+bool dut_register(const dut_t *dut)
+{
+    size_t i;
+    for (i = 0; i < MAX_DUTS && dut_table[i].name; i++) {
+        if (!strcmp(dut_table[i].name, dut->name))
+            break;
+    }
+    if (i == MAX_DUTS)
+        return false;
+    dut_table[i] = *dut;
+    return true;
+}
+
+const dut_t *dut_get(size_t i)
+{
+    return i < MAX_DUTS && dut_table[i].name ? &dut_table[i] : NULL;
+}
+
+const dut_t *dut_find(const char *cmd)
+{
+    for (size_t i = 0; i < MAX_DUTS && dut_table[i].name; i++) {
+        if (!strcmp(dut_table[i].cmd, cmd))
+            return &dut_table[i];
+    }
+    return NULL;
+}
+
+int dut_cpu = -1;
+
+/* Operation being tested */
+static const dut_t *dut;
+
+/* Inputs of operations which can be undone, a pool of FIXTURE_POOL per class
+ * of input, one of which is picked at random for every sample.  They are
+ * built once per test and restored by undoing every call, so no setup work
+ * depending on the class runs between two measurements.  All are relocated
+ * together every FIXTURE_SAMPLES samples, so that the few cycles the memory
+ * layout of given queues costs or saves average out instead of biasing one
+ * class.  Each starts a cache line of its own, or the fields of one class but
+ * not the other could straddle two.
+ */
+#define FIXTURE_SAMPLES 50
+#define FIXTURE_POOL 8
+
+static struct {
+    dut_input_t in;
+} __attribute__((aligned(64))) fixture[2][FIXTURE_POOL];
+static bool fixture_ready = false;
+
+/* Cycles taken by reading the counter itself, subtracted from every sample */
+static int64_t timer_overhead;
+
+#define CALIBRATION_READS 1000
+
+/* The cheapest of many back-to-back reads is what reading costs when nothing
+ * else gets in the way.
+ */
+static void calibrate_timer(void)
+{
+    timer_overhead = INT64_MAX;
+    for (int i = 0; i < CALIBRATION_READS; i++) {
+        int64_t before = cpucycles_start();
+        int64_t after = cpucycles_stop();
+        if (after - before < timer_overhead)
+            timer_overhead = after - before;
+    }
+    if (timer_overhead < 0)
+        timer_overhead = 0;
+}
+
+/* Voluntary and involuntary context switches of the calling thread so far.
+ * A sample during which it changed has timed another task as well.
+ */
+static long context_switches(void)
+{
+    struct rusage usage;
+#ifdef RUSAGE_THREAD
+    int who = RUSAGE_THREAD;
+#else
+    int who = RUSAGE_SELF;
+#endif
+    if (getrusage(who, &usage))
+        return 0;
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+#if defined(__linux__)
+static cpu_set_t saved_cpus;
+static bool pinned = false;
+
+/* Keep the measurements on CPU dut_cpu, so that they are not spread over
+ * cores running at different frequencies or with cold caches.
+ */
+static void pin_cpu(void)
+{
+    cpu_set_t set;
+
+    if (dut_cpu < 0 || dut_cpu >= CPU_SETSIZE)
+        return;
+    if (sched_getaffinity(0, sizeof(saved_cpus), &saved_cpus))
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(dut_cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        printf("Cannot pin simulation to CPU %d\n", dut_cpu);
+        return;
+    }
+    pinned = true;
+}
+
+static void unpin_cpu(void)
+{
+    if (pinned)
+        sched_setaffinity(0, sizeof(saved_cpus), &saved_cpus);
+    pinned = false;
+}
+#else
+static void pin_cpu(void) {}
+static void unpin_cpu(void) {}
+#endif
+
+/* Time one call of the operation on in.  Both ticks are equal if the sample
+ * is to be dropped.
+ */
+static void time_call(dut_input_t *in, int64_t *before, int64_t *after)
+{
+    long switches = context_switches();
+    int64_t start = cpucycles_start();
+    dut->call(in);
+    int64_t stop = cpucycles_stop();
+
+    *before = start;
+    if (context_switches() != switches) {
+        *after = start;
+        return;
+    }
+    /* Never turn a real sample into a dropped one */
+    stop -= timer_overhead;
+    *after = stop > start ? stop : start + 1;
+}
 
 /* Implement the necessary queue interface to simulation */
-void init_dut(void)
+void init_dut(const dut_t *d)
 {
-    l = NULL;
+    dut = d;
+    fixture_ready = false;
+    new_random_strings();
+    pin_cpu();
+    calibrate_timer();
 }
 
-static char *get_random_string(void)
+static void free_fixtures(void)
 {
-    random_string_iter = (random_string_iter + 1) % N_MEASURES;
-    return random_string[random_string_iter];
+    if (fixture_ready) {
+        for (int c = 0; c < 2; c++) {
+            for (int j = 0; j < FIXTURE_POOL; j++)
+                dut->teardown(&fixture[c][j].in);
+        }
+    }
+    fixture_ready = false;
+}
+
+void free_dut(void)
+{
+    free_fixtures();
+    unpin_cpu();
+}
+
+/* Class 0 gets the smallest queue the operation works on, class 1 one of
+ * random size.
+ */
+static int input_size(const uint8_t *input)
+{
+    return *(uint16_t *) input % DUT_MAX_SIZE + dut->min_size;
+}
+
+/* Fixtures of class 0 have a small fixed size instead, far below the mean of
+ * class 1, so that time growing with the size still tells the classes apart.
+ * It stays clear of queues of one or two elements, which take a few cycles
+ * longer to update than any other, as fenced timing is precise enough to
+ * tell.  Fixtures of class 1 get a size each, so that their samples cover a
+ * range of sizes.
+ */
+#define FIXED_SIZE_MARGIN 16
+
+static void build_fixtures(void)
+{
+    for (int j = 0; j < FIXTURE_POOL; j++) {
+        uint8_t n[CHUNK_SIZE];
+        int size[2];
+
+        randombytes(n, CHUNK_SIZE);
+        size[0] = dut->min_size + FIXED_SIZE_MARGIN;
+        size[1] = input_size(n);
+
+        /* Whichever is built last is warmer in the caches */
+        int c = randombit();
+        dut->setup(&fixture[c][j].in, size[c]);
+        dut->setup(&fixture[!c][j].in, size[!c]);
+    }
+    fixture_ready = true;
+}
+
+/* Move the queue of in to a new head, which then starts from one of the
+ * first RELOCATE_STEPS elements.  Both are O(1) list operations, and they
+ * change the addresses a call touches about as much as rebuilding the queue.
+ */
+#define RELOCATE_STEPS 64
+
+static void relocate(dut_input_t *in)
+{
+    struct list_head *q = q_new();
+    uint8_t steps;
+
+    if (!q)
+        return;
+    list_splice_init(in->q, q);
+    q_free(in->q);
+    in->q = q;
+
+    randombytes(&steps, 1);
+    struct list_head *node = q;
+    for (steps %= RELOCATE_STEPS; steps > 0; steps--)
+        node = node->next;
+    if (node != q) {
+        list_del(q);
+        list_add(q, node);
+    }
 }
 
 void prepare_inputs(uint8_t *input_data, uint8_t *classes)
@@ -60,103 +532,63 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
             memset(input_data + (size_t) i * CHUNK_SIZE, 0, CHUNK_SIZE);
     }
 
-    for (size_t i = 0; i < N_MEASURES; ++i) {
-        /* Generate random string */
-        randombytes((uint8_t *) random_string[i], 7);
-        random_string[i][7] = 0;
-    }
+    new_random_strings();
 }
 
-bool measure(int64_t *before_ticks,
-             int64_t *after_ticks,
-             uint8_t *input_data,
-             int mode)
-{
-    assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
-
-    switch (mode) {
-    case DUT(insert_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(insert_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(remove_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    case DUT(remove_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    default:
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
+bool measure(int64_t *before_ticks, int64_t *after_ticks, uint8_t *input_data)
+{
+    assert(dut);
+
+    /* Fixture of the pool of its class used by each sample */
+    uint8_t pick[N_MEASURES];
+    randombytes(pick, sizeof(pick));
+
+    for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        const uint8_t *input = input_data + i * CHUNK_SIZE;
+        dut_input_t sample, *in = &sample;
+
+        if (dut->undo) {
+            if (!fixture_ready) {
+                build_fixtures();
+            } else if ((i - DROP_SIZE) % FIXTURE_SAMPLES == 0) {
+                for (int j = 0; j < FIXTURE_POOL; j++) {
+                    int c = randombit();
+                    relocate(&fixture[c][j].in);
+                    relocate(&fixture[!c][j].in);
+                }
+            }
+            /* Inputs of class 0 are all zero */
+            int c = *(uint16_t *) input != 0;
+            in = &fixture[c][pick[i] % FIXTURE_POOL].in;
+            in->s = get_random_string();
+        } else {
+            dut->setup(in, input_size(input));
         }
+
+        time_call(in, &before_ticks[i], &after_ticks[i]);
+
+        if (!(dut->undo ? dut->undo(in) : dut->teardown(in)))
+            return false;
     }
     return true;
 }
+
+/* Samples of measure_size() taken again after a context switch */
+#define MEASURE_RETRIES 3
+
+/* Time one call of the operation on a queue of n elements */
+int64_t measure_size(int n, bool *ok)
+{
+    int64_t before = 0, after = 0;
+
+    assert(dut);
+    for (int i = 0; i <= MEASURE_RETRIES && after == before; i++) {
+        dut_input_t in;
+        dut->setup(&in, n);
+        time_call(&in, &before, &after);
+        *ok = dut->teardown(&in);
+        if (!*ok)
+            break;
+    }
+    return after - before;
+}
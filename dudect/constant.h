@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "queue.h"
+
 /* Number of measurements per test */
 #define N_MEASURES 150
 
@@ -12,25 +14,69 @@
 
 #define DROP_SIZE 20
 
-#define DUT_FUNCS  \
-    _(insert_head) \
-    _(insert_tail) \
-    _(remove_head) \
-    _(remove_tail)
+/* Largest queue an operation is measured on */
+#define DUT_MAX_SIZE 10000
+
+/* Expected growth of the execution time with the size of the queue */
+typedef enum {
+    DUT_CONSTANT,     /* tested for timing leakage */
+    DUT_LINEAR,       /* tested for complexity */
+    DUT_LINEARITHMIC, /* tested for complexity */
+} dut_complexity_t;
+
+/* What an operation is run on: queue @q of @size elements, string @s to
+ * insert, element @e removed and @ret returned by the call.  Queues to merge
+ * are chained in @chain.
+ */
+typedef struct {
+    struct list_head *q;
+    int size;
+    char *s;
+    element_t *e;
+    int ret;
+    struct list_head chain;
+    queue_contex_t ctx[2];
+} dut_input_t;
+
+/**
+ * dut_t - Operation under test
+ * @name: name of the operation, as in queue.h
+ * @cmd: qtest command testing it in simulation mode
+ * @complexity: expected growth of its execution time
+ * @min_size: smallest queue it works on
+ * @setup: build the input, a queue of n elements
+ * @call: the operation, which is what gets timed
+ * @undo: optional, revert the call to reuse the input; false on mismatch
+ * @teardown: release the input; false if the call left it inconsistent
+ */
+typedef struct {
+    const char *name;
+    const char *cmd;
+    dut_complexity_t complexity;
+    int min_size;
+    void (*setup)(dut_input_t *in, int n);
+    void (*call)(dut_input_t *in);
+    bool (*undo)(dut_input_t *in);
+    bool (*teardown)(dut_input_t *in);
+} dut_t;
+
+/* CPU the measurements are pinned to, or -1 to let them run anywhere */
+extern int dut_cpu;
 
-#define DUT(x) DUT_##x
+/* Registry of operations under test, holding those of queue.h to begin with.
+ * dut_register() adds an operation, or replaces the one of the same name.
+ */
+bool dut_register(const dut_t *dut);
+const dut_t *dut_get(size_t i);
+const dut_t *dut_find(const char *cmd);
 
-enum {
-#define _(x) DUT(x),
-    DUT_FUNCS
-#undef _
-};
+/* Helpers for setup functions */
+void dut_fill(struct list_head *q, int n);
 
-void init_dut();
+void init_dut(const dut_t *dut);
+void free_dut(void);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
-bool measure(int64_t *before_ticks,
-             int64_t *after_ticks,
-             uint8_t *input_data,
-             int mode);
+bool measure(int64_t *before_ticks, int64_t *after_ticks, uint8_t *input_data);
+int64_t measure_size(int n, bool *ok);
 
 #endif
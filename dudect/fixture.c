@@ -26,7 +26,6 @@
  *    variable time.
  */
 
-#include <assert.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -36,8 +35,13 @@
 #include "../console.h"
 #include "../random.h"
 
+/* Our buffers need to use regular malloc/free */
+#define INTERNAL 1
+#include "../harness.h"
+
 #include "constant.h"
 #include "fixture.h"
+#include "quantile.h"
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
@@ -49,6 +53,9 @@
 
 static t_context_t *ctxs[DUDECT_TESTS];
 
+/* Distribution of execution times over all batches of a test */
+static p2_context_t *sketch;
+
 /* threshold values for Welch's t-test */
 enum {
     t_threshold_bananas = 500, /* Test failed with overwhelming probability */
@@ -60,35 +67,32 @@ static void __attribute__((noreturn)) die(void)
     exit(111);
 }
 
-static int64_t percentile(const int64_t *a_sorted, double which, size_t size)
-{
-    assert(which >= 0 && which <= 1.0);
-    size_t pos = (size_t) (which * size);
-    return a_sorted[pos];
-}
-
-/* leverages the fact that comparison expressions return 1 or 0. */
-static int cmp(const void *aa, const void *bb)
-{
-    int64_t a = *(const int64_t *) aa, b = *(const int64_t *) bb;
-    return (a > b) - (a < b);
-}
-
 /* This function is used to set different thresholds for cropping measurements.
  * To filter out slow measurements, we keep only the fastest ones by a
  * complementary exponential decay scale as thresholds for cropping
  * measurements: threshold(x) = 1 - 0.5^(10 * x / N_MEASURES), where x is the
- * counter of the measurement.
+ * counter of the measurement.  The thresholds are quantiles estimated from
+ * all measurements of the test so far, so they settle as batches come in
+ * instead of following the noise of a single batch.
  */
-static void prepare_percentiles(int64_t *exec_times, int64_t *percentiles)
+static void prepare_percentiles(const int64_t *exec_times, int64_t *percentiles)
 {
-    qsort(exec_times, N_MEASURES, sizeof(int64_t), cmp);
-
-    for (size_t i = 0; i < NUM_PERCENTILES; i++) {
-        percentiles[i] = percentile(
-            exec_times, 1 - (pow(0.5, 10 * (double) (i + 1) / NUM_PERCENTILES)),
-            N_MEASURES);
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        /* Skip dropped measurements */
+        if (exec_times[i] > 0)
+            p2_push(sketch, exec_times[i]);
     }
+
+    for (size_t i = 0; i < NUM_PERCENTILES; i++)
+        percentiles[i] = (int64_t) p2_quantile(sketch, i);
+}
+
+static void init_percentiles(void)
+{
+    double probs[NUM_PERCENTILES];
+    for (size_t i = 0; i < NUM_PERCENTILES; i++)
+        probs[i] = 1 - pow(0.5, 10 * (double) (i + 1) / NUM_PERCENTILES);
+    p2_init(sketch, probs, NUM_PERCENTILES);
 }
 
 static void differentiate(int64_t *exec_times,
@@ -113,12 +117,19 @@ static void update_statistics(const int64_t *exec_times,
         t_push(ctxs[0], difference, classes[i]);
 
         /* t-test on cropped execution times, for several cropping thresholds.
+         * The thresholds do not decrease, so the sample goes to every test
+         * from the first threshold above it on.
          */
-        for (size_t j = 0; j < NUM_PERCENTILES; j++) {
-            if (difference < percentiles[j]) {
-                t_push(ctxs[j + 1], difference, classes[i]);
-            }
+        size_t lo = 0, hi = NUM_PERCENTILES;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (percentiles[mid] > difference)
+                hi = mid;
+            else
+                lo = mid + 1;
         }
+        for (size_t j = lo; j < NUM_PERCENTILES; j++)
+            t_push(ctxs[j + 1], difference, classes[i]);
     }
 }
 
@@ -136,17 +147,72 @@ static t_context_t *max_test()
     return ctxs[max_idx];
 }
 
-static bool report(void)
+/* Smallest number of measurements a sequential test decides on */
+#define SEQUENTIAL_MIN_MEASURE (ENOUGH_MEASURE / 10)
+
+int dut_confidence = 99;
+
+typedef enum {
+    TEST_UNDECIDED,
+    TEST_PASSED,
+    TEST_FAILED,
+} verdict_t;
+
+/* Normal quantile z of the given one-sided confidence, by bisection */
+static double z_score(double confidence)
+{
+    double lo = 0.0, hi = 10.0;
+    for (int i = 0; i < 64; i++) {
+        double mid = (lo + hi) / 2;
+        if (0.5 * erfc(-mid / M_SQRT2) < confidence)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Sequential analysis: a leak shows as a t statistic growing with the square
+ * root of the number of measurements n, and the test of a fixed
+ * ENOUGH_MEASURE measurements flags t above t_threshold_moderate.  Once n is
+ * large enough, the test fails as soon as max t is past that threshold by
+ * more than its margin of error z, and passes as soon as even max t plus z
+ * would not have grown past the threshold by ENOUGH_MEASURE measurements.
+ * Operations clearly constant time thus stop early, and borderline ones get
+ * measured for longer.
+ */
+static verdict_t sequential_verdict(double max_t, double n)
+{
+    /* Few measurements, cropped ones in particular, can have no variance */
+    if (n < SEQUENTIAL_MIN_MEASURE)
+        return TEST_UNDECIDED;
+    if (max_t > t_threshold_bananas)
+        return TEST_FAILED;
+
+    double z = z_score(dut_confidence / 100.0);
+    if (max_t > t_threshold_moderate + z)
+        return TEST_FAILED;
+    if (max_t + z < t_threshold_moderate * sqrt(n / ENOUGH_MEASURE))
+        return TEST_PASSED;
+    return TEST_UNDECIDED;
+}
+
+static bool sequential(void)
+{
+    return dut_confidence > 0 && dut_confidence < 100;
+}
+
+static verdict_t report(void)
 {
     t_context_t *t = max_test();
     double number_traces_max_t = t->n[0] + t->n[1];
 
     printf("\033[A\033[2K");
     printf("measure: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    if (number_traces_max_t < ENOUGH_MEASURE && !sequential()) {
         printf("not enough measurements (%.0f still to go).\n",
                ENOUGH_MEASURE - number_traces_max_t);
-        return false;
+        return TEST_FAILED;
     }
 
     double max_t = fabs(t_compute(t));
@@ -165,19 +231,25 @@ static bool report(void)
     printf("max t: %+7.2f, max tau: %.2e, (5/tau)^2: %.2e.\n", max_t, max_tau,
            (double) (5 * 5) / (double) (max_tau * max_tau));
 
+    if (sequential())
+        return sequential_verdict(max_t, number_traces_max_t);
+
     /* Definitely not constant time */
     if (max_t > t_threshold_bananas)
-        return false;
+        return TEST_FAILED;
 
     /* Probably not constant time. */
     if (max_t > t_threshold_moderate)
-        return false;
+        return TEST_FAILED;
 
     /* For the moment, maybe constant time. */
-    return true;
+    return TEST_PASSED;
 }
 
-static bool doit(int mode)
+/* Set for the first batch of every test */
+static bool first_time;
+
+static verdict_t doit(void)
 {
     int64_t *before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
     int64_t *after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
@@ -193,23 +265,22 @@ static bool doit(int mode)
 
     prepare_inputs(input_data, classes);
 
-    bool ret = measure(before_ticks, after_ticks, input_data, mode);
+    verdict_t ret = TEST_UNDECIDED;
+    bool ok = measure(before_ticks, after_ticks, input_data);
     differentiate(exec_times, before_ticks, after_ticks);
-    prepare_percentiles(exec_times, percentiles);
 
-    /* This warm-up step discards the first measurement batch by skipping
-     * its statistical analysis. A static boolean flag controls this by
-     * marking the initial execution, ensuring only the first call within
-     * a test run is excluded from the t-test computation.
+    /* This warm-up step discards the first measurement batch of a test by
+     * skipping its statistical analysis.
      */
-    static bool first_time = true;
     if (first_time) {
         first_time = false;
-        ret = true;
     } else {
+        prepare_percentiles(exec_times, percentiles);
         update_statistics(exec_times, classes, percentiles);
-        ret &= report();
+        ret = report();
     }
+    if (!ok)
+        ret = TEST_FAILED;
 
     free(before_ticks);
     free(after_ticks);
@@ -221,9 +292,10 @@ static bool doit(int mode)
     return ret;
 }
 
-static void init_once(void)
+static void init_once(const dut_t *dut)
 {
-    init_dut();
+    init_dut(dut);
+    first_time = true;
     for (size_t i = 0; i < DUDECT_TESTS; i++) {
         /* Check if ctxs[i] is unallocated to prevent repeated memory
          * allocations.
@@ -233,38 +305,142 @@ static void init_once(void)
             t_init(ctxs[i]);
         }
     }
+    if (!sketch) {
+        sketch = malloc(sizeof(p2_context_t));
+        init_percentiles();
+    }
 }
 
-static bool test_const(char *text, int mode)
+/* Without sequential analysis, only the verdict after the last batch of a
+ * try counts.  With it, any batch may settle the test, and the tries bound
+ * how long a borderline operation gets measured.
+ */
+static bool test_const(const dut_t *dut)
 {
-    bool result = false;
+    verdict_t verdict = TEST_UNDECIDED;
 
-    init_once();
+    init_once(dut);
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
-        printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
+        printf("Testing %s...(%d/%d)\n\n", dut->name, cnt, TEST_TRIES);
         for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
-             ++i)
-            result = doit(mode);
+             ++i) {
+            verdict = doit();
+            if (sequential() && verdict != TEST_UNDECIDED)
+                break;
+        }
         printf("\033[A\033[2K\033[A\033[2K");
-        if (result)
+        if (verdict == TEST_PASSED || (sequential() && verdict == TEST_FAILED))
             break;
     }
 
+    /* Out of tries, a sequential test falls back to the fixed threshold */
+    bool result = verdict == TEST_PASSED;
+    if (verdict == TEST_UNDECIDED)
+        result = fabs(t_compute(max_test())) <= t_threshold_moderate;
+
     for (size_t i = 0; i < DUDECT_TESTS; i++) {
         free(ctxs[i]);
         ctxs[i] = NULL;
     }
+    free(sketch);
+    sketch = NULL;
+    free_dut();
 
     return result;
 }
 
-#define DUT_FUNC_IMPL(op)                \
-    bool is_##op##_const(void)           \
-    {                                    \
-        return test_const(#op, DUT(op)); \
+/* Complexity is tested on queues of 2^COMPLEXITY_SHIFT elements and the
+ * following powers of two, timing each size COMPLEXITY_REPS times.  The
+ * exponent of the growth of the median time is fitted by least squares.
+ * Caches make large queues slower per element, so some slack is allowed
+ * over the expected exponent.
+ */
+#define COMPLEXITY_SHIFT 6
+#define COMPLEXITY_SIZES 8
+#define COMPLEXITY_REPS 15
+#define COMPLEXITY_SLACK 0.5
+
+static int cmp_ticks(const void *aa, const void *bb)
+{
+    int64_t a = *(const int64_t *) aa, b = *(const int64_t *) bb;
+    return (a > b) - (a < b);
+}
+
+/* Exponent of n in f(n) over the sizes tested */
+static double growth(double (*f)(double n))
+{
+    double lo = 1 << COMPLEXITY_SHIFT;
+    double hi = 1 << (COMPLEXITY_SHIFT + COMPLEXITY_SIZES - 1);
+    return log(f(hi) / f(lo)) / log(hi / lo);
+}
+
+static double f_linear(double n)
+{
+    return n;
+}
+
+static double f_linearithmic(double n)
+{
+    return n * log(n);
+}
+
+static bool fit_complexity(const dut_t *dut, double *exponent)
+{
+    int64_t ticks[COMPLEXITY_SIZES][COMPLEXITY_REPS];
+    bool ok = true;
+
+    /* Go through all sizes in turn, so that noise spreads over them */
+    for (int r = 0; r < COMPLEXITY_REPS; r++) {
+        for (int i = 0; i < COMPLEXITY_SIZES; i++) {
+            ticks[i][r] = measure_size(1 << (COMPLEXITY_SHIFT + i), &ok);
+            if (!ok)
+                return false;
+        }
+    }
+
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < COMPLEXITY_SIZES; i++) {
+        qsort(ticks[i], COMPLEXITY_REPS, sizeof(int64_t), cmp_ticks);
+        double x = (COMPLEXITY_SHIFT + i) * log(2);
+        double y = log(ticks[i][COMPLEXITY_REPS / 2] > 0
+                           ? ticks[i][COMPLEXITY_REPS / 2]
+                           : 1);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    *exponent = (COMPLEXITY_SIZES * sxy - sx * sy) /
+                (COMPLEXITY_SIZES * sxx - sx * sx);
+    return true;
+}
+
+static bool test_complexity(const dut_t *dut)
+{
+    double expected = growth(dut->complexity == DUT_LINEARITHMIC
+                                 ? f_linearithmic
+                                 : f_linear);
+    double exponent = 0;
+    bool result = false;
+
+    init_dut(dut);
+    for (int cnt = 0; cnt < TEST_TRIES && !result; ++cnt) {
+        printf("Testing %s...(%d/%d)\n", dut->name, cnt, TEST_TRIES);
+        if (!fit_complexity(dut, &exponent))
+            break;
+        printf("\033[A\033[2K");
+        printf("growth: n^%.2f, expected: n^%.2f.\n", exponent, expected);
+        result = exponent <= expected + COMPLEXITY_SLACK;
     }
+    free_dut();
 
-#define _(x) DUT_FUNC_IMPL(x)
-DUT_FUNCS
-#undef _
+    return result;
+}
+
+bool dut_test(const dut_t *dut)
+{
+    if (dut->complexity == DUT_CONSTANT)
+        return test_const(dut);
+    return test_complexity(dut);
+}
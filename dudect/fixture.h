@@ -4,9 +4,15 @@
 #include <stdbool.h>
 #include "constant.h"
 
-/* Interface to test if function is constant */
-#define _(x) bool is_##x##_const(void);
-DUT_FUNCS
-#undef _
+/* Confidence, in percent, with which a constant time test may stop as soon as
+ * its outcome is clear.  Out of (0, 100), tests run fixed batches.
+ */
+extern int dut_confidence;
+
+/* Test if the timing of an operation fits its expected complexity: constant
+ * time operations must not leak timing, the others must not grow faster than
+ * expected.
+ */
+bool dut_test(const dut_t *dut);
 
 #endif
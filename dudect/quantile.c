@@ -0,0 +1,122 @@
+/**
+ * Streaming quantile estimation.
+ *
+ * Extended P-square algorithm: several quantiles are estimated at once from
+ * a single set of markers, without storing the observations.  Each quantile
+ * p gets a marker of its own, and markers halfway between neighbouring
+ * quantiles (plus the minimum and the maximum) keep the estimates apart.
+ * Marker heights are adjusted with a piecewise-parabolic prediction as the
+ * markers drift from their desired positions.
+ *
+ * See R. Jain and I. Chlamtac, "The P2 algorithm for dynamic calculation of
+ * quantiles and histograms without storing observations", CACM 28(10), 1985,
+ * and K. E. E. Raatikainen, "Simultaneous estimation of several percentiles",
+ * Simulation 49(4), 1987.
+ */
+
+#include <assert.h>
+
+#include "quantile.h"
+
+void p2_init(p2_context_t *ctx, const double *probs, size_t n)
+{
+    assert(n <= P2_MAX_QUANTILES);
+    ctx->m = 2 * n + 3;
+    ctx->count = 0;
+
+    double prev = 0.0;
+    ctx->want[0] = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        assert(probs[i] >= prev && probs[i] <= 1.0);
+        ctx->want[2 * i + 1] = (prev + probs[i]) / 2;
+        ctx->want[2 * i + 2] = probs[i];
+        prev = probs[i];
+    }
+    ctx->want[2 * n + 1] = (prev + 1.0) / 2;
+    ctx->want[2 * n + 2] = 1.0;
+}
+
+/* Height of marker i moved by d (+1 or -1) positions, predicted by a
+ * parabola through its neighbours, or linearly if that leaves the interval.
+ */
+static double p2_adjust(const p2_context_t *ctx, size_t i, int d)
+{
+    const double *q = ctx->height, *n = ctx->pos;
+    double h = q[i] + d / (n[i + 1] - n[i - 1]) *
+                          ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) /
+                               (n[i + 1] - n[i]) +
+                           (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) /
+                               (n[i] - n[i - 1]));
+    if (q[i - 1] < h && h < q[i + 1])
+        return h;
+    return q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+}
+
+void p2_push(p2_context_t *ctx, double x)
+{
+    size_t m = ctx->m;
+    double *q = ctx->height, *n = ctx->pos;
+
+    /* Until every marker has a height, keep the observations sorted */
+    if (ctx->count < m) {
+        size_t i = ctx->count++;
+        for (; i > 0 && q[i - 1] > x; i--)
+            q[i] = q[i - 1];
+        q[i] = x;
+        if (ctx->count == m) {
+            for (i = 0; i < m; i++)
+                n[i] = i + 1;
+        }
+        return;
+    }
+
+    /* Find the cell k holding x, widening the extremes if needed */
+    size_t k;
+    if (x < q[0]) {
+        q[0] = x;
+        k = 0;
+    } else if (x >= q[m - 1]) {
+        q[m - 1] = x;
+        k = m - 2;
+    } else {
+        size_t lo = 0, hi = m - 1;
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (q[mid] <= x)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        k = lo;
+    }
+    for (size_t i = k + 1; i < m; i++)
+        n[i] += 1;
+    ctx->count++;
+
+    /* Move the inner markers which are off their desired positions */
+    for (size_t i = 1; i < m - 1; i++) {
+        double d = 1 + (ctx->count - 1) * ctx->want[i] - n[i];
+        if ((d >= 1 && n[i + 1] - n[i] > 1) ||
+            (d <= -1 && n[i - 1] - n[i] < -1)) {
+            int s = d > 0 ? 1 : -1;
+            q[i] = p2_adjust(ctx, i, s);
+            n[i] += s;
+        }
+    }
+}
+
+/* Estimate of the i-th quantile given to p2_init() */
+double p2_quantile(const p2_context_t *ctx, size_t i)
+{
+    size_t marker = 2 * i + 2;
+    assert(marker < ctx->m);
+
+    if (ctx->count >= ctx->m)
+        return ctx->height[marker];
+    if (!ctx->count)
+        return 0.0;
+
+    /* Too few observations yet, pick from the sorted ones */
+    size_t pos = (size_t) (ctx->want[marker] * ctx->count);
+    return ctx->height[pos < ctx->count ? pos : ctx->count - 1];
+}
@@ -0,0 +1,22 @@
+#ifndef DUDECT_QUANTILE_H
+#define DUDECT_QUANTILE_H
+
+#include <stddef.h>
+
+/* Maximum number of quantiles tracked by one estimator */
+#define P2_MAX_QUANTILES 100
+#define P2_MAX_MARKERS (2 * P2_MAX_QUANTILES + 3)
+
+typedef struct {
+    size_t m;                    /* number of markers */
+    size_t count;                /* observations so far */
+    double height[P2_MAX_MARKERS];
+    double pos[P2_MAX_MARKERS];  /* actual marker positions, 1-based */
+    double want[P2_MAX_MARKERS]; /* probability each marker tracks */
+} p2_context_t;
+
+void p2_init(p2_context_t *ctx, const double *probs, size_t n);
+void p2_push(p2_context_t *ctx, double x);
+double p2_quantile(const p2_context_t *ctx, size_t i);
+
+#endif
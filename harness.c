@@ -2,12 +2,14 @@
 
 #include <setjmp.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "random.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -41,12 +43,24 @@ typedef struct __block_element {
     /* Also place magic number at tail of every block */
 } block_element_t;
 
+#ifndef HARNESS_FAST
 static block_element_t *allocated = NULL;
+#endif
 static size_t allocated_count = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Deterministic failure schedule, restarted by fault_reset() */
+int fail_seed = 1;
+int fail_nth = 0;
+int fail_every = 0;
+static char fail_site[64] = "";
+
+/* State of the failure generator and number of eligible allocations */
+static uint64_t fault_state;
+static uint64_t fault_count = 0;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
@@ -68,13 +82,145 @@ typedef enum {
 
 /* Internal functions */
 
-/* Should this allocation fail? */
-static bool fail_allocation()
+/* xorshift64*, cheap enough to be consulted on every allocation */
+static inline uint64_t fault_next()
+{
+    if (!fault_state)
+        fault_reset();
+    fault_state ^= fault_state >> 12;
+    fault_state ^= fault_state << 25;
+    fault_state ^= fault_state >> 27;
+    return fault_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Should this allocation fail?
+ * Schedules are combined: the allocation fails if any of them fires.  When
+ * only a site is given, every allocation made from that site fails.
+ */
+static bool fail_allocation(const char *site)
+{
+    if (!(fail_probability | fail_nth | fail_every | fail_site[0]))
+        return false;
+
+    if (fail_site[0] && (!site || strcmp(site, fail_site)))
+        return false;
+
+    fault_count++;
+    if (fail_nth > 0 && fault_count == (uint64_t) fail_nth)
+        return true;
+    if (fail_every > 0 && fault_count % (uint64_t) fail_every == 0)
+        return true;
+    if (fail_probability > 0)
+        return (fault_next() >> 32) * 100 <
+               ((uint64_t) fail_probability << 32);
+
+    return fail_site[0] && !fail_nth && !fail_every;
+}
+
+#ifdef HARNESS_FAST
+/* Lightweight harness: allocations go straight to the C library and only the
+ * block counter and the payload size are maintained.  No block list, footers
+ * or fill patterns, so performance runs measure the queue code rather than us,
+ * but failure injection and realloc behave as with the checked harness.
+ */
+
+/* Size of the payload, ahead of it and keeping its alignment */
+typedef union {
+    size_t payload_size;
+    max_align_t align;
+} fast_header_t;
+
+static fast_header_t *find_header(void *p)
+{
+    return (fast_header_t *) p - 1;
+}
+
+static void *alloc(alloc_t alloc_type, size_t size, const char *site)
+{
+    if (noallocate_mode) {
+        char *msg_alloc_forbidden[] = {
+            "Calls to malloc are disallowed",
+            "Calls to calloc are disallowed",
+            "Calls to realloc are disallowed",
+        };
+        report_event(MSG_FATAL, "%s", msg_alloc_forbidden[alloc_type]);
+        return NULL;
+    }
+
+    if (fail_allocation(site)) {
+        char *msg_alloc_failure[] = {
+            "Malloc returning NULL",
+            "Calloc returning NULL",
+            "Realloc returning NULL",
+        };
+        report_event(MSG_WARN, "%s", msg_alloc_failure[alloc_type]);
+        return NULL;
+    }
+
+    fast_header_t *b = alloc_type == TEST_CALLOC
+                           ? calloc(1, sizeof(fast_header_t) + size)
+                           : malloc(sizeof(fast_header_t) + size);
+    if (!b) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        error_occurred = true;
+        return NULL;
+    }
+
+    b->payload_size = size;
+    allocated_count++;
+    return b + 1;
+}
+
+/* Implementation of application functions */
+
+void *test_malloc(size_t size, const char *site)
+{
+    return alloc(TEST_MALLOC, size, site);
+}
+
+// cppcheck-suppress unusedFunction
+void *test_calloc(size_t nelem, size_t elsize, const char *site)
+{
+    if (!nelem || !elsize || nelem > SIZE_MAX / elsize)
+        return NULL;
+    return alloc(TEST_CALLOC, nelem * elsize, site);
+}
+
+void *test_realloc(void *p, size_t new_size, const char *site)
+{
+    if (!p)
+        return alloc(TEST_REALLOC, new_size, site);
+
+    /* Same as the checked harness: never shrink, grow by copying */
+    const fast_header_t *b = find_header(p);
+    if (b->payload_size >= new_size)
+        return p;
+
+    void *new_ptr = alloc(TEST_REALLOC, new_size, site);
+    if (!new_ptr)
+        return NULL;
+    memcpy(new_ptr, p, b->payload_size);
+    test_free(p);
+
+    return new_ptr;
+}
+
+void test_free(void *p)
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+
+    if (!p)
+        return;
+
+    free(find_header(p));
+    allocated_count--;
 }
 
+#else /* !HARNESS_FAST */
+
 /* Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
  */
@@ -123,7 +269,7 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
-static void *alloc(alloc_t alloc_type, size_t size)
+static void *alloc(alloc_t alloc_type, size_t size, const char *site)
 {
     if (noallocate_mode) {
         char *msg_alloc_forbidden[] = {
@@ -135,7 +281,7 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
-    if (fail_allocation()) {
+    if (fail_allocation(site)) {
         char *msg_alloc_failure[] = {
             "Malloc returning NULL",
             "Calloc returning NULL",
@@ -174,36 +320,36 @@ static void *alloc(alloc_t alloc_type, size_t size)
 
 /* Implementation of application functions */
 
-void *test_malloc(size_t size)
+void *test_malloc(size_t size, const char *site)
 {
-    return alloc(TEST_MALLOC, size);
+    return alloc(TEST_MALLOC, size, site);
 }
 
 // cppcheck-suppress unusedFunction
-void *test_calloc(size_t nelem, size_t elsize)
+void *test_calloc(size_t nelem, size_t elsize, const char *site)
 {
     /* Reference: Malloc tutorial
      * https://danluu.com/malloc-tutorial/
      */
     if (!nelem || !elsize || nelem > SIZE_MAX / elsize)
         return NULL;
-    return alloc(TEST_CALLOC, nelem * elsize);
+    return alloc(TEST_CALLOC, nelem * elsize, site);
 }
 
 /*
  * Implementation of adjusting the size of the memory allocated
  * by test_malloc or test_calloc.
  */
-void *test_realloc(void *p, size_t new_size)
+void *test_realloc(void *p, size_t new_size, const char *site)
 {
     if (!p)
-        return alloc(TEST_REALLOC, new_size);
+        return alloc(TEST_REALLOC, new_size, site);
 
     const block_element_t *b = find_header(p);
     if (b->payload_size >= new_size)
         return p;
 
-    void *new_ptr = alloc(TEST_REALLOC, new_size);
+    void *new_ptr = alloc(TEST_REALLOC, new_size, site);
     if (!new_ptr)
         return NULL;
     memcpy(new_ptr, p, b->payload_size);
@@ -249,11 +395,13 @@ void test_free(void *p)
     allocated_count--;
 }
 
+#endif /* HARNESS_FAST */
+
 // cppcheck-suppress unusedFunction
-char *test_strdup(const char *s)
+char *test_strdup(const char *s, const char *site)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = test_malloc(len, site);
     if (!new)
         return NULL;
 
@@ -267,6 +415,23 @@ size_t allocation_check()
 
 /* Implementation of functions for testing */
 
+/* Restart the failure schedule from fail_seed */
+void fault_reset()
+{
+    fault_state = random_shuffle((uintptr_t) fail_seed);
+    fault_count = 0;
+}
+
+/* Restrict failures to allocations made in the named function */
+void fault_set_site(const char *site)
+{
+    if (!site)
+        site = "";
+    strncpy(fail_site, site, sizeof(fail_site) - 1);
+    fail_site[sizeof(fail_site) - 1] = '\0';
+    fault_reset();
+}
+
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
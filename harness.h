@@ -10,11 +10,14 @@
  * allow checking for common allocation errors.
  */
 
-void *test_malloc(size_t size);
-void *test_calloc(size_t nmemb, size_t size);
-void *test_realloc(void *p, size_t new_size);
+/* Allocating functions take the name of the calling function as @site, so
+ * that failures can be injected into one particular caller.
+ */
+void *test_malloc(size_t size, const char *site);
+void *test_calloc(size_t nmemb, size_t size, const char *site);
+void *test_realloc(void *p, size_t new_size, const char *site);
 void test_free(void *p);
-char *test_strdup(const char *s);
+char *test_strdup(const char *s, const char *site);
 
 #ifdef INTERNAL
 
@@ -24,6 +27,22 @@ size_t allocation_check();
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Deterministic failure schedule.
+ * fail_seed seeds the generator behind fail_probability, fail_nth fails the
+ * Nth allocation and fail_every fails every Kth one.  Allocations are counted
+ * from the last call to fault_reset(), and only those made from the site given
+ * to fault_set_site() are counted when a site is set.
+ */
+extern int fail_seed;
+extern int fail_nth;
+extern int fail_every;
+
+/* Restart the failure schedule: reseed generator and clear the counter */
+void fault_reset();
+
+/* Restrict failures to allocations made in function site, NULL for any */
+void fault_set_site(const char *site);
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -53,15 +72,21 @@ void trigger_exception(char *msg);
 
 #else /* !INTERNAL */
 
+/* Pull in the library prototypes first, so that including them later does
+ * not run into the macros below.
+ */
+#include <stdlib.h>
+#include <string.h>
+
 /* Tested program use our versions of malloc and free */
-#define malloc test_malloc
-#define calloc test_calloc
-#define realloc test_realloc
+#define malloc(size) test_malloc(size, __func__)
+#define calloc(nmemb, size) test_calloc(nmemb, size, __func__)
+#define realloc(p, size) test_realloc(p, size, __func__)
 #define free test_free
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
-#define strdup test_strdup
+#define strdup(s) test_strdup(s, __func__)
 
 #endif
 
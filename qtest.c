@@ -2,29 +2,36 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #if defined(__APPLE__)
 #include <mach/mach_time.h>
-#else /* Assume POSIX environments */
-#include <time.h>
 #endif
 
-#include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
 
 /* Shannon entropy */
 extern double shannon_entropy(const uint8_t *input_data);
+extern double shannon_entropy_add(const uint8_t *input_data, uint64_t *total);
+extern double shannon_entropy_histogram(const uint64_t *bucket,
+                                        uint64_t count);
 extern int show_entropy;
 
 /* Our program needs to use regular malloc/free */
@@ -44,6 +51,9 @@ extern int show_entropy;
  */
 #include "queue.h"
 
+#include "compare.h"
+#include "dudect/fixture.h"
+#include "dudect/quantile.h"
 #include "console.h"
 #include "report.h"
 
@@ -75,6 +85,16 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Deferred freeing.
+ * With lazy_free set, a large queue being freed is parked on the graveyard in
+ * O(1).  Its elements are released at most reclaim_chunk at a time, before
+ * each command and while waiting for input, and the emptied head finally goes
+ * to q_free.
+ */
+static int lazy_free = 0;
+static int reclaim_chunk = 4096;
+static LIST_HEAD(graveyard);
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -86,6 +106,70 @@ typedef enum {
 /* Forward declarations */
 static bool q_show(int vlevel);
 
+/* Free the queue of ctx along with ctx, or leave it to reclaim_step() */
+static void q_release(queue_contex_t *ctx)
+{
+    if (lazy_free && ctx->q && ctx->size > BIG_LIST_SIZE) {
+        list_add_tail(&ctx->chain, &graveyard);
+        return;
+    }
+
+    if (ctx->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        q_free(ctx->q);
+    exception_cancel();
+    set_cautious_mode(true);
+    free(ctx);
+}
+
+/* Release up to reclaim_chunk elements of parked queues.
+ * Return true if some are left.
+ */
+static bool reclaim_step()
+{
+    if (list_empty(&graveyard))
+        return false;
+
+    int budget = reclaim_chunk > 0 ? reclaim_chunk : 1;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        while (budget > 0 && !list_empty(&graveyard)) {
+            queue_contex_t *ctx =
+                list_first_entry(&graveyard, queue_contex_t, chain);
+            while (budget-- > 0 && !list_empty(ctx->q)) {
+                element_t *e = list_first_entry(ctx->q, element_t, list);
+                list_del(&e->list);
+                q_release_element(e);
+            }
+            if (list_empty(ctx->q)) {
+                q_free(ctx->q);
+                list_del(&ctx->chain);
+                free(ctx);
+            }
+        }
+    } else {
+        /* Give up on a queue that cannot be walked */
+        queue_contex_t *ctx =
+            list_first_entry(&graveyard, queue_contex_t, chain);
+        list_del(&ctx->chain);
+        free(ctx);
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    if (!list_empty(&graveyard))
+        return true;
+
+    size_t bcnt = allocation_check();
+    if (!chain.size && bcnt > 0) {
+        report(1,
+               "ERROR: There is no queue, but %lu blocks are still allocated",
+               bcnt);
+    }
+    return false;
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -101,9 +185,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -112,23 +193,16 @@ static bool do_free(int argc, char *argv[])
 
     if (current) {
         list_del(&current->chain);
-
-        if (exception_setup(true))
-            q_free(current->q);
-        exception_cancel();
-        set_cautious_mode(true);
-    }
-
-    if (current) {
-        free(current);
+        q_release(current);
         chain.size--;
         current = qnext ? list_entry(qnext, queue_contex_t, chain) : NULL;
     }
 
     q_show(3);
 
+    /* Blocks of parked queues are checked once they are all released */
     size_t bcnt = allocation_check();
-    if (!chain.size && bcnt > 0) {
+    if (!chain.size && bcnt > 0 && list_empty(&graveyard)) {
         report(1,
                "ERROR: There is no queue, but %lu blocks are still allocated",
                bcnt);
@@ -183,22 +257,6 @@ static void fill_rand_string(char *buf, size_t buf_size)
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
-
     char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
@@ -290,28 +348,6 @@ static bool do_it(int argc, char *argv[])
 
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
-    /* FIXME: It is known that both functions is_remove_tail_const() and
-     * is_remove_head_const() can not pass dudect on Apple M1 (based on Arm64).
-     * We shall figure out the exact reasons and resolve later.
-     */
-#if !(defined(__aarch64__) && defined(__APPLE__))
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
-#endif
-
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
@@ -447,6 +483,7 @@ static bool do_dedup(int argc, char *argv[])
                 break;
             }
             memcpy(tmp->value, item->value, slen);
+            tmp->prefix = item->prefix;
             list_add_tail(&tmp->list, &l_copy);
         }
         // Return false if the loop does not leave properly
@@ -483,14 +520,14 @@ static bool do_dedup(int argc, char *argv[])
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
             item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
+            str_eq(list_entry(item->list.next, element_t, list)->value,
+                   item->value);
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
         } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
+                   str_eq(list_entry(l_tmp, element_t, list)->value,
+                          item->value))
             l_tmp = l_tmp->next;
         else
             ok = false;
@@ -625,20 +662,20 @@ bool do_sort(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && str_cmp(item->value, next_item->value) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && str_cmp(item->value, next_item->value) < 0) {
                 report(1, "ERROR: Not sorted in descending order");
                 ok = false;
                 break;
             }
             /* Ensure the stability of the sort */
             if (current->size <= MAX_NODES &&
-                !strcmp(item->value, next_item->value)) {
+                str_eq(item->value, next_item->value)) {
                 bool unstable = false;
                 for (unsigned i = 0; i < MAX_NODES; i++) {
                     if (nodes[i] == cur_l->next) {
@@ -752,7 +789,7 @@ static bool do_ascend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+            if (str_cmp(item->value, next_item->value) > 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -799,7 +836,7 @@ static bool do_descend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
+            if (str_cmp(item->value, next_item->value) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -871,8 +908,8 @@ static bool do_merge(int argc, char *argv[])
         while ((uintptr_t) cur != (uintptr_t) &chain.head) {
             queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
-            q_free(ctx->q);
-            free(ctx);
+            ctx->size = 0;
+            q_release(ctx);
         }
 
         chain.head.prev = &current->chain;
@@ -887,7 +924,7 @@ static bool do_merge(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && str_cmp(item->value, next_item->value) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
@@ -897,7 +934,7 @@ static bool do_merge(int argc, char *argv[])
             }
 
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && str_cmp(item->value, next_item->value) < 0) {
                 report(
                     1,
                     "ERROR: Not sorted in descending order (It might because "
@@ -943,7 +980,7 @@ static bool q_show(int vlevel)
     if (verblevel < vlevel)
         return true;
 
-    int cnt = 0;
+    int cnt = 0, stale = 0;
     if (!current || !current->q) {
         report(vlevel, "l = NULL");
         return true;
@@ -970,6 +1007,8 @@ static bool q_show(int vlevel)
                         shannon_entropy((const uint8_t *) e->value));
                 }
             }
+            if (e->prefix != str_prefix(e->value))
+                stale++;
             cnt++;
             cur = cur->next;
             ok = ok && !error_check();
@@ -994,20 +1033,583 @@ static bool q_show(int vlevel)
         ok = false;
     }
 
+    if (stale) {
+        report(vlevel, "ERROR:  %d elements have a key prefix not matching "
+               "their value", stale);
+        ok = false;
+    }
+
+    return ok;
+}
+
+/* Serialized queue contents.
+ *
+ * "show json" and "dump" build their whole output in one buffer, which then
+ * goes out with a single write.  The JSON form reads
+ *   {"current": 0, "queues": [{"id": 0, "size": 2, "elements": ["a", "b"]}]}
+ * The binary form is little-endian: magic "QDMP", u32 version, u32 number of
+ * queues, then per queue i32 id and u32 number of elements, and per element
+ * u32 length followed by the bytes of its string.
+ */
+#define DUMP_MAGIC "QDMP"
+#define DUMP_VERSION 1
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    bool failed;
+} sbuf_t;
+
+/* Once an allocation failed, nothing more is taken, so that the contents are
+ * never mistaken for a complete serialization
+ */
+static bool sbuf_reserve(sbuf_t *s, size_t n)
+{
+    if (s->failed)
+        return false;
+    if (s->len + n <= s->cap)
+        return true;
+
+    size_t cap = s->cap ? s->cap : 4096;
+    while (cap < s->len + n)
+        cap *= 2;
+    char *buf = realloc(s->buf, cap);
+    if (!buf) {
+        s->failed = true;
+        return false;
+    }
+    s->buf = buf;
+    s->cap = cap;
+    return true;
+}
+
+static void sbuf_put(sbuf_t *s, const void *p, size_t n)
+{
+    if (!sbuf_reserve(s, n))
+        return;
+    memcpy(s->buf + s->len, p, n);
+    s->len += n;
+}
+
+static void sbuf_printf(sbuf_t *s, const char *fmt, ...)
+{
+    char tmp[64];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    sbuf_put(s, tmp, n);
+}
+
+static void sbuf_u32(sbuf_t *s, uint32_t v)
+{
+    uint8_t b[4] = {v, v >> 8, v >> 16, v >> 24};
+    sbuf_put(s, b, sizeof(b));
+}
+
+/* Append str as JSON string, copying runs that need no escape in one go */
+static void sbuf_json_str(sbuf_t *s, const char *str)
+{
+    sbuf_put(s, "\"", 1);
+    const char *run = str;
+    for (const char *p = str; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        sbuf_put(s, run, p - run);
+        if (c == '"' || c == '\\') {
+            char esc[2] = {'\\', c};
+            sbuf_put(s, esc, 2);
+        } else {
+            sbuf_printf(s, "\\u%04x", c);
+        }
+        run = p + 1;
+    }
+    sbuf_put(s, run, strlen(run));
+    sbuf_put(s, "\"", 1);
+}
+
+/* Append the elements of the queue in ctx.  Return false if the queue does
+ * not hold as many elements as recorded.
+ */
+static bool serialize_queue(sbuf_t *s, const queue_contex_t *ctx, bool binary)
+{
+    int cnt = 0;
+    if (binary) {
+        sbuf_u32(s, ctx->id);
+        sbuf_u32(s, ctx->q ? ctx->size : 0);
+    } else {
+        sbuf_printf(s, "{\"id\": %d, \"size\": %d, \"elements\": ", ctx->id,
+                    ctx->size);
+        if (!ctx->q) {
+            sbuf_put(s, "null}", 5);
+            return true;
+        }
+        sbuf_put(s, "[", 1);
+    }
+    if (!ctx->q)
+        return true;
+
+    const struct list_head *cur = ctx->q->next;
+    while (cur && cur != ctx->q && cnt < ctx->size) {
+        const element_t *e = list_entry(cur, element_t, list);
+        if (binary) {
+            size_t len = strlen(e->value);
+            sbuf_u32(s, len);
+            sbuf_put(s, e->value, len);
+        } else {
+            if (cnt)
+                sbuf_put(s, ", ", 2);
+            sbuf_json_str(s, e->value);
+        }
+        cnt++;
+        cur = cur->next;
+    }
+    if (!binary)
+        sbuf_put(s, "]}", 2);
+
+    if (cnt != ctx->size || cur != ctx->q) {
+        report(1, "ERROR: Queue %d does not hold %d elements", ctx->id,
+               ctx->size);
+        return false;
+    }
+    return true;
+}
+
+/* Serialize the current queue, or all queues in chain if all is set */
+static bool serialize(sbuf_t *s, bool all, bool binary)
+{
+    uint32_t nq = all ? chain.size : !!current;
+    if (binary) {
+        sbuf_put(s, DUMP_MAGIC, 4);
+        sbuf_u32(s, DUMP_VERSION);
+        sbuf_u32(s, nq);
+    } else {
+        sbuf_printf(s, "{\"current\": %d, \"queues\": [",
+                    current ? current->id : -1);
+    }
+
+    bool ok = true;
+    if (exception_setup(true)) {
+        if (all) {
+            const queue_contex_t *ctx;
+            int i = 0;
+            list_for_each_entry (ctx, &chain.head, chain) {
+                if (i++ && !binary)
+                    sbuf_put(s, ", ", 2);
+                ok = ok && serialize_queue(s, ctx, binary);
+            }
+        } else if (current) {
+            ok = serialize_queue(s, current, binary);
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    if (!binary)
+        sbuf_put(s, "]}\n", 4);
+    if (s->failed) {
+        report(1, "ERROR: Could not allocate output buffer");
+        ok = false;
+    }
     return ok;
 }
 
 static bool do_show(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc == 1) {
+        if (current)
+            report(1, "Current queue ID: %d", current->id);
+        return q_show(0);
+    }
+
+    bool all = argc == 3 && !strcmp(argv[2], "all");
+    if (strcmp(argv[1], "json") || (argc == 3 && !all) || argc > 3) {
+        report(1, "Usage: %s [json [all]]", argv[0]);
         return false;
     }
 
-    if (current)
-        report(1, "Current queue ID: %d", current->id);
+    /* Nothing is shown of a queue that could not be serialized in full */
+    sbuf_t s = {0};
+    if (!serialize(&s, all, false)) {
+        free(s.buf);
+        return false;
+    }
+    /* Keep the terminator for the web interface out of the length */
+    s.len--;
+    report_write(0, s.buf, s.len);
+    free(s.buf);
+    return true;
+}
 
-    return q_show(0);
+static bool do_dump(int argc, char *argv[])
+{
+    bool binary = false;
+    if (argc == 3 && !strcmp(argv[2], "bin"))
+        binary = true;
+    else if (argc != 2 && !(argc == 3 && !strcmp(argv[2], "json"))) {
+        report(1, "Usage: %s file [json|bin]", argv[0]);
+        return false;
+    }
+
+    sbuf_t s = {0};
+    bool ok = serialize(&s, true, binary);
+    if (!binary && ok)
+        s.len--;
+
+    int fd = !ok ? -1 : open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ok && fd < 0) {
+        report(1, "ERROR: Could not open '%s': %s", argv[1], strerror(errno));
+        ok = false;
+    }
+    if (fd >= 0) {
+        for (size_t n = 0; n < s.len;) {
+            ssize_t w = write(fd, s.buf + n, s.len - n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0) {
+                report(1, "ERROR: Could not write '%s': %s", argv[1],
+                       strerror(errno));
+                ok = false;
+                break;
+            }
+            n += w;
+        }
+        close(fd);
+    }
+    free(s.buf);
+    return ok;
+}
+
+/* Queue snapshots.
+ *
+ * "save" writes every queue in chain to a file that "load" maps back into
+ * memory.  The file starts with a snapshot_hdr_t, followed by the number of
+ * elements of each queue (u64), the offsets of all strings into the pool
+ * (u64, one more than there are strings, so that string i spans offsets i to
+ * i + 1), and the pool of NUL-terminated strings itself.  Values are in the
+ * byte order of the machine that wrote the file.
+ */
+#define SNAPSHOT_MAGIC "QSNP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nqueues;
+    uint32_t current; /* index of current queue, UINT32_MAX if none */
+    uint64_t nstrings;
+    uint64_t pool_size;
+} snapshot_hdr_t;
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
+
+    snapshot_hdr_t hdr = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .nqueues = chain.size,
+        .current = UINT32_MAX,
+    };
+    uint64_t *counts = calloc(chain.size + 1, sizeof(uint64_t));
+    if (!counts) {
+        report(1, "ERROR: Could not allocate space for snapshot");
+        return false;
+    }
+
+    /* First pass sizes the tables, as they precede the pool */
+    bool ok = true;
+    const queue_contex_t *ctx;
+    uint32_t i = 0;
+    if (exception_setup(false)) {
+        list_for_each_entry (ctx, &chain.head, chain) {
+            if (ctx == current)
+                hdr.current = i;
+            const element_t *e;
+            if (ctx->q) {
+                list_for_each_entry (e, ctx->q, list) {
+                    hdr.pool_size += strlen(e->value) + 1;
+                    counts[i]++;
+                }
+            }
+            hdr.nstrings += counts[i++];
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    FILE *f = ok ? fopen(argv[1], "wb") : NULL;
+    if (ok && !f) {
+        report(1, "ERROR: Could not open '%s': %s", argv[1], strerror(errno));
+        ok = false;
+    }
+    if (f) {
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        fwrite(counts, sizeof(uint64_t), hdr.nqueues, f);
+
+        uint64_t off = 0;
+        list_for_each_entry (ctx, &chain.head, chain) {
+            const element_t *e;
+            if (!ctx->q)
+                continue;
+            list_for_each_entry (e, ctx->q, list) {
+                fwrite(&off, sizeof(off), 1, f);
+                off += strlen(e->value) + 1;
+            }
+        }
+        fwrite(&off, sizeof(off), 1, f);
+
+        list_for_each_entry (ctx, &chain.head, chain) {
+            const element_t *e;
+            if (!ctx->q)
+                continue;
+            list_for_each_entry (e, ctx->q, list)
+                fwrite(e->value, 1, strlen(e->value) + 1, f);
+        }
+
+        if (ferror(f) | fclose(f)) {
+            report(1, "ERROR: Could not write '%s'", argv[1]);
+            ok = false;
+        }
+    }
+    free(counts);
+
+    if (ok)
+        report(1, "Saved %u queues with %lu elements", hdr.nqueues,
+               (unsigned long) hdr.nstrings);
+    return ok;
+}
+
+/* Build an element holding the len bytes at s, which need not be terminated.
+ * Elements are allocated the way queue code does, so that it can free them.
+ */
+static element_t *new_element(const char *s, size_t len)
+{
+    element_t *e = test_malloc(sizeof(element_t), __func__);
+    char *value = e ? test_malloc(len + 1, __func__) : NULL;
+    if (!value) {
+        test_free(e);
+        return NULL;
+    }
+    memcpy(value, s, len);
+    value[len] = '\0';
+    e->value = value;
+    e->prefix = str_prefix(value);
+    return e;
+}
+
+/* Append n strings of the pool to queue q, building the nodes directly.
+ * Return the number of elements appended, which falls short of n when an
+ * allocation fails.
+ */
+static uint64_t load_elements(struct list_head *q,
+                              const char *pool,
+                              const uint64_t *off,
+                              uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        element_t *e = new_element(pool + off[i], off[i + 1] - off[i] - 1);
+        if (!e)
+            return i;
+        list_add_tail(&e->list, q);
+    }
+    return n;
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        report(1, "ERROR: Could not open '%s': %s", argv[1], strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    const char *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                           : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        report(1, "ERROR: Could not map '%s'", argv[1]);
+        return false;
+    }
+    madvise((void *) map, size, MADV_SEQUENTIAL);
+
+    /* Validate the whole layout before building anything */
+    const snapshot_hdr_t *hdr = (const snapshot_hdr_t *) map;
+    const uint64_t *counts = (const uint64_t *) (hdr + 1);
+    const uint64_t *off = counts + (size >= sizeof(*hdr) ? hdr->nqueues : 0);
+    const char *pool = (const char *) (off + (size >= sizeof(*hdr)
+                                                   ? hdr->nstrings + 1
+                                                   : 0));
+    bool valid = size >= sizeof(*hdr) &&
+                 !memcmp(hdr->magic, SNAPSHOT_MAGIC, 4) &&
+                 hdr->version == SNAPSHOT_VERSION &&
+                 hdr->nstrings < size / sizeof(uint64_t) &&
+                 hdr->nqueues < size / sizeof(uint64_t) &&
+                 (size_t) (pool - map) <= size &&
+                 hdr->pool_size == size - (size_t) (pool - map);
+    uint64_t total = 0;
+    for (uint32_t i = 0; valid && i < hdr->nqueues; i++) {
+        valid = counts[i] <= hdr->nstrings - total;
+        total += counts[i];
+    }
+    valid = valid && total == hdr->nstrings && off[0] == 0 &&
+            off[total] == hdr->pool_size;
+    for (uint64_t i = 0; valid && i < total; i++) {
+        valid = off[i] < off[i + 1] && off[i + 1] <= hdr->pool_size &&
+                pool[off[i + 1] - 1] == '\0';
+    }
+    if (!valid) {
+        report(1, "ERROR: '%s' is not a valid snapshot", argv[1]);
+        munmap((void *) map, size);
+        return false;
+    }
+
+    bool ok = true;
+    uint64_t loaded = 0;
+    if (exception_setup(false)) {
+        queue_contex_t *cur = NULL;
+        for (uint32_t i = 0; ok && i < hdr->nqueues; i++) {
+            queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+            if (!qctx) {
+                ok = false;
+                break;
+            }
+            list_add_tail(&qctx->chain, &chain.head);
+            qctx->size = 0;
+            qctx->q = q_new();
+            qctx->id = chain.size++;
+            if (i == hdr->current || !cur)
+                cur = qctx;
+            if (!qctx->q) {
+                ok = false;
+                break;
+            }
+
+            uint64_t n = load_elements(qctx->q, pool, off + loaded, counts[i]);
+            qctx->size = n;
+            loaded += counts[i];
+            ok = n == counts[i];
+        }
+        if (cur)
+            current = cur;
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    uint32_t nqueues = hdr->nqueues;
+    munmap((void *) map, size);
+
+    if (!ok)
+        report(1, "ERROR: Could not allocate space for snapshot");
+    else
+        report(1, "Loaded %u queues with %lu elements", nqueues,
+               (unsigned long) total);
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Insert every non-empty line of a file into the current queue.
+ * Lines are found with memchr over the mapped file and copied straight into
+ * their elements, so the file is read once and never parsed as commands.
+ */
+static bool do_ingest(int argc, char *argv[])
+{
+    bool head = false;
+    if (argc == 3 && !strcmp(argv[2], "head"))
+        head = true;
+    else if (argc != 2 && !(argc == 3 && !strcmp(argv[2], "tail"))) {
+        report(1, "Usage: %s file [head|tail]", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling ingest on null queue");
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        report(1, "ERROR: Could not open '%s': %s", argv[1], strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    const char *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                           : NULL;
+    close(fd);
+    if (map == MAP_FAILED) {
+        report(1, "ERROR: Could not map '%s'", argv[1]);
+        return false;
+    }
+    if (map)
+        madvise((void *) map, size, MADV_SEQUENTIAL);
+
+    bool ok = true, full = false;
+    size_t cnt = 0;
+    /* The size of a queue is an int, so stop the file short of overflowing it */
+    size_t room = (size_t) INT_MAX - current->size;
+    if (exception_setup(false)) {
+        const char *p = map, *end = map + size;
+        while (p < end) {
+            const char *eol = memchr(p, '\n', end - p);
+            const char *next = eol ? eol + 1 : end;
+            if (!eol)
+                eol = end;
+            if (eol > p && eol[-1] == '\r')
+                eol--;
+            if (eol > p) {
+                if (cnt == room) {
+                    full = true;
+                    ok = false;
+                    break;
+                }
+                element_t *e = new_element(p, eol - p);
+                if (!e) {
+                    ok = false;
+                    break;
+                }
+                if (head)
+                    list_add(&e->list, current->q);
+                else
+                    list_add_tail(&e->list, current->q);
+                cnt++;
+            }
+            p = next;
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    current->size += cnt;
+    if (map)
+        munmap((void *) map, size);
+
+    if (full)
+        report(1, "ERROR: Queue would exceed %d elements after %lu lines",
+               INT_MAX, (unsigned long) cnt);
+    else if (!ok)
+        report(1, "ERROR: Could not allocate space after %lu lines",
+               (unsigned long) cnt);
+    else
+        report(1, "Inserted %lu lines", (unsigned long) cnt);
+    q_show(3);
+    return ok && !error_check();
 }
 
 static bool do_prev(int argc, char *argv[])
@@ -1056,6 +1658,554 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Entropy analysis.
+ *
+ * The entropy command reports the distribution of the entropy of the elements
+ * of the current queue, or of every queue, along with the entropy of all their
+ * bytes taken together.  Elements are split among worker threads, which only
+ * read the strings and allocate nothing.
+ */
+#define ENTROPY_BINS 10
+#define ENTROPY_MAX_THREADS 64
+/* Fewest elements worth a thread of their own */
+#define ENTROPY_MIN_PER_THREAD 16384
+
+typedef struct {
+    element_t **elems;
+    size_t n;
+    double min, max, sum;
+    size_t bin[ENTROPY_BINS];
+    uint64_t bytes[256];
+} entropy_part_t;
+
+static void *entropy_worker(void *arg)
+{
+    entropy_part_t *part = arg;
+
+    part->min = 100.0;
+    part->max = 0.0;
+    for (size_t i = 0; i < part->n; i++) {
+        double h = shannon_entropy_add((const uint8_t *) part->elems[i]->value,
+                                       part->bytes);
+        if (h < part->min)
+            part->min = h;
+        if (h > part->max)
+            part->max = h;
+        part->sum += h;
+        int b = (int) (h * ENTROPY_BINS / 100.0);
+        part->bin[b < ENTROPY_BINS ? b : ENTROPY_BINS - 1]++;
+    }
+    return NULL;
+}
+
+/* Append the elements of queue ctx to elems, which has room for cap */
+static bool entropy_collect(queue_contex_t *ctx,
+                            element_t **elems,
+                            size_t cap,
+                            size_t *n)
+{
+    struct list_head *cur = NULL;
+    size_t cnt = 0;
+
+    if (!ctx->q)
+        return true;
+    if (exception_setup(true)) {
+        for (cur = ctx->q->next; cur != ctx->q && *n < cap; cur = cur->next) {
+            elems[(*n)++] = list_entry(cur, element_t, list);
+            cnt++;
+        }
+    }
+    exception_cancel();
+    if (cur != ctx->q || cnt != (size_t) ctx->size) {
+        report(1, "ERROR: Queue %d does not hold %d elements", ctx->id,
+               ctx->size);
+        return false;
+    }
+    return true;
+}
+
+static bool do_entropy(int argc, char *argv[])
+{
+    bool all = false;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = ncpu > 0 ? (int) ncpu : 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "all")) {
+            all = true;
+        } else if (strncmp(argv[i], "threads=", 8) ||
+                   !get_int(argv[i] + 8, &threads) || threads < 1) {
+            report(1, "Usage: %s [all] [threads=n]", argv[0]);
+            return false;
+        }
+    }
+    if (threads > ENTROPY_MAX_THREADS)
+        threads = ENTROPY_MAX_THREADS;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling entropy on null queue");
+        return false;
+    }
+
+    size_t cap = 0, n = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if (all || ctx == current)
+            cap += ctx->size;
+    }
+    element_t **elems = malloc(sizeof(element_t *) * (cap ? cap : 1));
+    if (!elems) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for entropy");
+        return false;
+    }
+    bool ok = true;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if (ok && (all || ctx == current))
+            ok = entropy_collect(ctx, elems, cap, &n);
+    }
+    if (!ok) {
+        free(elems);
+        return false;
+    }
+
+    if ((size_t) threads > n / ENTROPY_MIN_PER_THREAD)
+        threads = n / ENTROPY_MIN_PER_THREAD ? n / ENTROPY_MIN_PER_THREAD : 1;
+    entropy_part_t part[ENTROPY_MAX_THREADS];
+    pthread_t tid[ENTROPY_MAX_THREADS];
+    int started = 0;
+    memset(part, 0, sizeof(entropy_part_t) * threads);
+    for (int t = 0; t < threads; t++) {
+        part[t].elems = elems + n * t / threads;
+        part[t].n = n * (t + 1) / threads - n * t / threads;
+    }
+
+    /* The alarm of the time limit is meant for this thread, not the workers */
+    sigset_t signals, old;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_SETMASK, &signals, &old);
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&tid[started], NULL, entropy_worker,
+                           &part[started + 1]))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    /* Take over the parts of workers that could not be started */
+    for (int t = started + 1; t < threads; t++)
+        entropy_worker(&part[t]);
+    entropy_worker(&part[0]);
+    for (int t = 0; t < started; t++)
+        pthread_join(tid[t], NULL);
+
+    entropy_part_t sum = {.min = 100.0, .max = 0.0};
+    uint64_t nbytes = 0;
+    for (int t = 0; t < threads; t++) {
+        if (part[t].n && part[t].min < sum.min)
+            sum.min = part[t].min;
+        if (part[t].n && part[t].max > sum.max)
+            sum.max = part[t].max;
+        sum.sum += part[t].sum;
+        for (int b = 0; b < ENTROPY_BINS; b++)
+            sum.bin[b] += part[t].bin[b];
+        for (int c = 0; c < 256; c++)
+            sum.bytes[c] += part[t].bytes[c];
+    }
+    for (int c = 0; c < 256; c++)
+        nbytes += sum.bytes[c];
+    free(elems);
+
+    report(1, "%zu elements, %lu bytes, %d thread%s", n,
+           (unsigned long) nbytes, threads, threads > 1 ? "s" : "");
+    if (!n)
+        return true;
+    report(1, "  element entropy: min %3.2f%%, mean %3.2f%%, max %3.2f%%",
+           sum.min, sum.sum / n, sum.max);
+    for (int b = 0; b < ENTROPY_BINS; b++) {
+        if (!sum.bin[b])
+            continue;
+        report(1, "  %3d-%3d%% %10zu", b * 100 / ENTROPY_BINS,
+               (b + 1) * 100 / ENTROPY_BINS, sum.bin[b]);
+    }
+    report(1, "  aggregate entropy: %3.2f%%",
+           shannon_entropy_histogram(sum.bytes, nbytes));
+    return true;
+}
+
+/* Synthetic workloads.
+ *
+ * The workload command drives the current queue with a random mix of
+ * operations, drawing strings from a fixed pool of keys, and reports the
+ * throughput together with latency percentiles for each kind of operation.
+ * The percentiles are P-square estimates, so memory does not grow with the
+ * number of operations.
+ */
+typedef enum {
+    WL_INSERT,
+    WL_REMOVE,
+    WL_SORT,
+    WL_DEDUP,
+    WL_MERGE,
+    WL_NOPS,
+} wl_op_t;
+
+static const char *wl_op_name[WL_NOPS] = {
+    "insert", "remove", "sort", "dedup", "merge",
+};
+
+/* Number of strings merged into the queue by each periodic merge */
+#define WL_MERGE_BATCH 64
+
+typedef struct {
+    int insert;   /* Percent of operations that insert, the rest remove */
+    int head;     /* Percent of inserts and removes done at the head */
+    double zipf;  /* Exponent of the key popularity, 0 for uniform */
+    int keys;     /* Number of distinct strings */
+    int min_len;  /* Range of string lengths */
+    int max_len;
+    int sort;     /* Sort every this many operations, 0 to never sort */
+    int dedup;    /* Sort and remove duplicates every this many operations */
+    int merge;    /* Sort and merge a fresh batch every this many operations */
+    int seed;
+} wl_config_t;
+
+static uint64_t wl_state;
+
+static inline uint64_t wl_random()
+{
+    wl_state += 0x9e3779b97f4a7c15ULL;
+    return random_shuffle(wl_state);
+}
+
+/* Uniform double in [0, 1) */
+static inline double wl_uniform()
+{
+    return (wl_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool wl_parse(int argc, char *argv[], wl_config_t *cfg)
+{
+    for (int i = 2; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (!eq) {
+            report(1, "Expected key=value instead of '%s'", argv[i]);
+            return false;
+        }
+        *eq = '\0';
+        char *key = argv[i], *val = eq + 1, *end;
+        bool ok = true;
+        if (!strcmp(key, "insert"))
+            ok = get_int(val, &cfg->insert);
+        else if (!strcmp(key, "head"))
+            ok = get_int(val, &cfg->head);
+        else if (!strcmp(key, "keys"))
+            ok = get_int(val, &cfg->keys);
+        else if (!strcmp(key, "sort"))
+            ok = get_int(val, &cfg->sort);
+        else if (!strcmp(key, "dedup"))
+            ok = get_int(val, &cfg->dedup);
+        else if (!strcmp(key, "merge"))
+            ok = get_int(val, &cfg->merge);
+        else if (!strcmp(key, "seed"))
+            ok = get_int(val, &cfg->seed);
+        else if (!strcmp(key, "zipf")) {
+            cfg->zipf = strtod(val, &end);
+            ok = end != val && *end == '\0';
+        } else if (!strcmp(key, "len")) {
+            /* Either a fixed length or a range min-max */
+            cfg->min_len = strtol(val, &end, 10);
+            cfg->max_len = cfg->min_len;
+            if (*end == '-')
+                cfg->max_len = strtol(end + 1, &end, 10);
+            ok = *end == '\0';
+        } else {
+            report(1, "Unknown workload parameter '%s'", key);
+            return false;
+        }
+        *eq = '=';
+        if (!ok) {
+            report(1, "Invalid value in '%s'", argv[i]);
+            return false;
+        }
+    }
+
+    if (cfg->insert < 0 || cfg->insert > 100 || cfg->head < 0 ||
+        cfg->head > 100 || cfg->keys < 1 || cfg->zipf < 0 ||
+        cfg->min_len < 1 || cfg->max_len < cfg->min_len ||
+        cfg->max_len >= MAXSTRING || cfg->sort < 0 || cfg->dedup < 0 ||
+        cfg->merge < 0) {
+        report(1, "Workload parameter out of range");
+        return false;
+    }
+    return true;
+}
+
+/* Index of the key drawn from the cumulative distribution cdf */
+static int wl_pick(const double *cdf, int keys)
+{
+    double u = wl_uniform() * cdf[keys - 1];
+    int lo = 0, hi = keys - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] <= u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static inline int64_t wl_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Latency percentiles reported for each kind of operation */
+static const double wl_probs[] = {0.5, 0.9, 0.99, 0.999};
+#define WL_NPROBS (sizeof(wl_probs) / sizeof(wl_probs[0]))
+
+/* Latencies of one kind of operation, kept in constant space */
+typedef struct {
+    p2_context_t p2;
+    int64_t max;
+} wl_latency_t;
+
+/* Merge a sorted batch of fresh keys into the sorted current queue.
+ * On failure, the current queue is left as it was.
+ */
+static bool wl_merge(char **pool, const double *cdf, int keys)
+{
+    struct list_head *side = q_new();
+    if (!side) {
+        report(1, "Could not allocate the queue of keys to merge");
+        return false;
+    }
+
+    for (int i = 0; i < WL_MERGE_BATCH; i++) {
+        if (!q_insert_tail(side, pool[wl_pick(cdf, keys)])) {
+            report(1, "Could not insert the keys to merge");
+            q_free(side);
+            return false;
+        }
+    }
+
+    queue_contex_t ctx[2] = {
+        {.q = current->q, .id = current->id},
+        {.q = side, .id = -1},
+    };
+    ctx[0].size = current->size;
+    ctx[1].size = q_size(side);
+
+    LIST_HEAD(local_chain);
+    list_add_tail(&ctx[0].chain, &local_chain);
+    list_add_tail(&ctx[1].chain, &local_chain);
+    q_sort(side, descend);
+    current->size = q_merge(&local_chain, descend);
+    q_free(side);
+    return true;
+}
+
+static bool do_workload(int argc, char *argv[])
+{
+    int n = 0;
+    if (argc < 2 || !get_int(argv[1], &n) || n < 1) {
+        report(1, "%s needs a positive number of operations", argv[0]);
+        return false;
+    }
+
+    wl_config_t cfg = {
+        .insert = 50,
+        .head = 50,
+        .zipf = 0,
+        .keys = 1000,
+        .min_len = MIN_RANDSTR_LEN,
+        .max_len = MAX_RANDSTR_LEN,
+        .seed = 1,
+    };
+    if (!wl_parse(argc, argv, &cfg))
+        return false;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling workload on null queue");
+        return false;
+    }
+    error_check();
+
+    /* Key pool and the cumulative distribution of its popularity */
+    char **pool = malloc(sizeof(char *) * cfg.keys);
+    double *cdf = malloc(sizeof(double) * cfg.keys);
+    wl_latency_t *lat = malloc(sizeof(wl_latency_t) * WL_NOPS);
+    if (!pool || !cdf || !lat) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for workload");
+        free(pool);
+        free(cdf);
+        free(lat);
+        return false;
+    }
+    for (int i = 0; i < WL_NOPS; i++) {
+        p2_init(&lat[i].p2, wl_probs, WL_NPROBS);
+        lat[i].max = 0;
+    }
+
+    wl_state = (uint64_t) cfg.seed;
+    double total = 0;
+    for (int k = 0; k < cfg.keys; k++) {
+        int len = cfg.min_len + wl_random() % (cfg.max_len - cfg.min_len + 1);
+        pool[k] = malloc(len + 1);
+        if (!pool[k]) {
+            report(1, "INTERNAL ERROR.  Could not allocate workload keys");
+            while (k--)
+                free(pool[k]);
+            free(pool);
+            free(cdf);
+            free(lat);
+            return false;
+        }
+        for (int j = 0; j < len; j++)
+            pool[k][j] = charset[wl_random() % (sizeof(charset) - 1)];
+        pool[k][len] = '\0';
+        total += cfg.zipf > 0 ? pow(k + 1, -cfg.zipf) : 1.0;
+        cdf[k] = total;
+    }
+
+    bool ok = true;
+    int done = 0;
+    int64_t start = wl_now();
+    /* The queue is expected to grow large, so skip the O(n) check on free */
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        for (int i = 1; ok && i <= n; i++) {
+            wl_op_t op;
+            int64_t t0 = wl_now();
+            if (cfg.dedup && i % cfg.dedup == 0) {
+                op = WL_DEDUP;
+                q_sort(current->q, descend);
+                q_delete_dup(current->q);
+                t0 = wl_now() - t0;
+                current->size = q_size(current->q);
+            } else if (cfg.merge && i % cfg.merge == 0) {
+                op = WL_MERGE;
+                q_sort(current->q, descend);
+                ok = wl_merge(pool, cdf, cfg.keys);
+                t0 = wl_now() - t0;
+                if (!ok)
+                    break;
+            } else if (cfg.sort && i % cfg.sort == 0) {
+                op = WL_SORT;
+                q_sort(current->q, descend);
+                t0 = wl_now() - t0;
+            } else if (current->size == 0 ||
+                       (int) (wl_random() % 100) < cfg.insert) {
+                op = WL_INSERT;
+                char *s = pool[wl_pick(cdf, cfg.keys)];
+                bool at_head = (int) (wl_random() % 100) < cfg.head;
+                t0 = wl_now();
+                bool rval = at_head ? q_insert_head(current->q, s)
+                                    : q_insert_tail(current->q, s);
+                t0 = wl_now() - t0;
+                if (rval)
+                    current->size++;
+            } else {
+                op = WL_REMOVE;
+                bool at_head = (int) (wl_random() % 100) < cfg.head;
+                t0 = wl_now();
+                element_t *e = at_head ? q_remove_head(current->q, NULL, 0)
+                                       : q_remove_tail(current->q, NULL, 0);
+                t0 = wl_now() - t0;
+                if (e) {
+                    q_release_element(e);
+                    current->size--;
+                }
+            }
+            p2_push(&lat[op].p2, t0);
+            if (t0 > lat[op].max)
+                lat[op].max = t0;
+            done = i;
+            ok = !error_check();
+        }
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+    double elapsed = (wl_now() - start) / 1e9;
+
+    report(1, "%d operations in %.3f s (%.0f ops/s), queue size %d", done,
+           elapsed, elapsed > 0 ? done / elapsed : 0.0, current->size);
+    report(1, "  %-8s %10s %10s %10s %10s %10s %10s", "op", "count", "p50",
+           "p90", "p99", "p99.9", "max(ns)");
+    for (int i = 0; i < WL_NOPS; i++) {
+        const p2_context_t *p2 = &lat[i].p2;
+        if (!p2->count)
+            continue;
+        report(1, "  %-8s %10zu %10.0f %10.0f %10.0f %10.0f %10ld",
+               wl_op_name[i], p2->count, p2_quantile(p2, 0),
+               p2_quantile(p2, 1), p2_quantile(p2, 2), p2_quantile(p2, 3),
+               (long) lat[i].max);
+    }
+
+    for (int k = 0; k < cfg.keys; k++)
+        free(pool[k]);
+    free(pool);
+    free(cdf);
+    free(lat);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_malloc_site(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    fault_set_site(argc == 2 ? argv[1] : NULL);
+    if (argc == 2)
+        report(2, "Malloc failures restricted to allocations in %s", argv[1]);
+    else
+        report(2, "Malloc failures allowed at any site");
+    return true;
+}
+
+/* Changing any failure parameter restarts the schedule from the seed */
+static void fault_setter(int oldval)
+{
+    fault_reset();
+}
+
+/* Test the timing of the operation registered for the command, in place of
+ * running it
+ */
+static bool do_simulate(int argc, char *argv[])
+{
+    const dut_t *dut = dut_find(argv[0]);
+    if (!simulation || !dut) {
+        report(1, "%s only runs in simulation mode", argv[0]);
+        return false;
+    }
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+
+    const char *expect = "constant time";
+    if (dut->complexity == DUT_LINEAR)
+        expect = "O(n)";
+    else if (dut->complexity == DUT_LINEARITHMIC)
+        expect = "O(n log n)";
+
+    /* Keep the checks of test_free() out of the timing */
+    set_cautious_mode(false);
+    bool ok = dut_test(dut);
+    set_cautious_mode(true);
+    if (!ok) {
+        report(1, "ERROR: Probably not %s or wrong implementation", expect);
+        return false;
+    }
+    report(1, "Probably %s", expect);
+    return true;
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1081,7 +2231,21 @@ static void console_init()
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descending order", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
-    ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(show,
+                "Show queue contents, as JSON if asked. Add 'all' for every "
+                "queue",
+                "[json [all]]");
+    ADD_COMMAND(dump, "Write all queues to file as JSON or binary",
+                "file [json|bin]");
+    ADD_COMMAND(save, "Save snapshot of all queues to file", "file");
+    ADD_COMMAND(load, "Append queues saved in snapshot file", "file");
+    ADD_COMMAND(entropy,
+                "Show entropy of elements and of all their bytes, over every "
+                "queue with 'all'",
+                "[all] [threads=n]");
+    ADD_COMMAND(ingest,
+                "Insert each line of file at tail (default) or head of queue",
+                "file [head|tail]");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
@@ -1096,14 +2260,44 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(workload,
+                "Run n random operations on queue and report throughput and "
+                "latency. Tunable with insert=% head=% keys=k zipf=s len=a-b "
+                "sort=p dedup=p merge=p seed=x",
+                "n [key=val ...]");
+    ADD_COMMAND(malloc_site,
+                "Only fail allocations made in function name. Omit name to "
+                "fail at any site",
+                "[name]");
+    /* Operations under test in simulation mode */
+    for (size_t i = 0; dut_get(i); i++) {
+        add_sim_cmd((char *) dut_get(i)->cmd, do_simulate,
+                    "Test timing of operation in simulation mode");
+    }
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
-              NULL);
+              fault_setter);
+    add_param("malloc_seed", &fail_seed, "Seed of malloc failure generator",
+              fault_setter);
+    add_param("malloc_nth", &fail_nth, "Fail the nth allocation (0: never)",
+              fault_setter);
+    add_param("malloc_every", &fail_every,
+              "Fail every nth allocation (0: never)", fault_setter);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("lazy_free", &lazy_free,
+              "Release large queues in chunks across later commands", NULL);
+    add_param("reclaim_chunk", &reclaim_chunk,
+              "Number of elements released per step of lazy freeing", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("sim_cpu", &dut_cpu,
+              "Pin simulation to CPU (-1: no pinning)", NULL);
+    add_param("sim_confidence", &dut_confidence,
+              "Confidence percent to stop constant time tests early (0: "
+              "never)",
+              NULL);
 }
 
 /* Signal handlers */
@@ -1128,6 +2322,7 @@ static void sigalrm_handler(int sig)
 static void q_init()
 {
     fail_count = 0;
+    fault_reset();
     INIT_LIST_HEAD(&chain.head);
     signal(SIGSEGV, sigsegv_handler);
     signal(SIGALRM, sigalrm_handler);
@@ -1136,6 +2331,8 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
+    while (reclaim_step())
+        ;
     if (current && current->size > BIG_LIST_SIZE)
         set_cautious_mode(false);
 
@@ -1436,6 +2633,7 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    set_step_helper(reclaim_step);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "compare.h"
 #include "queue.h"
 
 #define q_is_empty(__head) list_empty(__head)
@@ -47,6 +48,7 @@ bool q_insert_head(struct list_head *head, char *s)
     new_elem->value = strdup(s);
     if (!new_elem->value)
         goto failed_alloc_value;
+    new_elem->prefix = str_prefix(new_elem->value);
 
     list_add(&new_elem->list, head);
     return true;
@@ -67,6 +69,7 @@ bool q_insert_tail(struct list_head *head, char *s)
     new_elem->value = strdup(s);
     if (!new_elem->value)
         goto failed_alloc_value;
+    new_elem->prefix = str_prefix(new_elem->value);
 
     list_add_tail(&new_elem->list, head);
     return true;
@@ -173,7 +176,8 @@ bool q_delete_dup(struct list_head *head)
         iter = curr->next;
         while (iter != head) {
             iter_elem = list_entry(iter, typeof(*iter_elem), list);
-            if (strcmp(iter_elem->value, curr_elem->value))
+            if (iter_elem->prefix != curr_elem->prefix ||
+                !str_eq(iter_elem->value, curr_elem->value))
                 break;
             iter = iter->next;
             dup = true;
@@ -241,10 +245,41 @@ void q_reverse(struct list_head *head)
     } while (curr != head);
 }
 
-/* Reverse the nodes of the list k at a time */
-void q_reverseK(struct list_head *head, int k)
+/* Reverse the run of up to k nodes after prev in place and splice it back
+ * between prev and the node following it.  Return the number of nodes
+ * reversed, which falls short of k when the run reaches head.
+ */
+static int q_reverse_run(struct list_head *head, struct list_head *prev, int k)
+{
+    struct list_head *first = prev->next, *last = prev, *curr, *next;
+    int num = 0;
+
+    for (curr = first; num < k && curr != head; num++) {
+        next = curr->next;
+        curr->next = last;
+        curr->prev = next;
+        last = curr;
+        curr = next;
+    }
+    if (!num)
+        return 0;
+
+    prev->next = last;
+    last->prev = prev;
+    first->next = curr;
+    curr->prev = first;
+    return num;
+}
+
+/* Groups of fewer nodes are checked to be complete before being reversed.
+ * The walk brings the group into the cache for the reversal, which beats
+ * reversing blindly until the group outgrows the cache.
+ */
+#define REVERSEK_LOOKAHEAD 128
+
+/* Reverse the nodes of the list k at a time, walking ahead of each group */
+static void q_reverseK_lookahead(struct list_head *head, int k)
 {
-    // https://leetcode.com/problems/reverse-nodes-in-k-group/
     struct list_head *curr, *iter, *temp, *prev, *new_head, *new_tail;
     int num;
     list_for_each (curr, head) {
@@ -271,19 +306,47 @@ void q_reverseK(struct list_head *head, int k)
     }
 }
 
-static bool cmp_ascend(const char *str1, const char *str2)
+/* Reverse the nodes of the list k at a time */
+void q_reverseK(struct list_head *head, int k)
 {
-    return strcmp(str1, str2) > 0;
-}
+    // https://leetcode.com/problems/reverse-nodes-in-k-group/
+    struct list_head *prev, *first;
+    int num;
 
-static bool cmp_descend(const char *str1, const char *str2)
-{
-    return strcmp(str1, str2) < 0;
+    if (!head || k < 2)
+        return;
+    if (k == 2) {
+        q_swap(head);
+        return;
+    }
+    if (k < REVERSEK_LOOKAHEAD) {
+        q_reverseK_lookahead(head, k);
+        return;
+    }
+
+    /* Reverse groups without looking ahead.  A short group at the end is
+     * found only once reversed, and is then turned back.
+     */
+    for (prev = head;; prev = first) {
+        first = prev->next;
+        num = q_reverse_run(head, prev, k);
+        if (num < k) {
+            q_reverse_run(head, prev, num);
+            break;
+        }
+    }
 }
 
-static int q_sort_interval(struct list_head **head,
-                           struct list_head **tail,
-                           bool (*cmp)(const char *, const char *))
+static int q_sort_ascend(struct list_head **head, struct list_head **tail);
+static int q_sort_descend(struct list_head **head, struct list_head **tail);
+
+/* Merge sort between head and tail.  Always inlined into q_sort_ascend and
+ * q_sort_descend, so that each has the order of comparison built in.
+ */
+static inline __attribute__((always_inline)) int q_sort_interval(
+    struct list_head **head,
+    struct list_head **tail,
+    const bool descend)
 {
     element_t *l_elem, *r_elem;
     struct list_head *l, *l_tail, *r, *temp;
@@ -295,7 +358,8 @@ static int q_sort_interval(struct list_head **head,
     else if ((*head)->next == *tail) {
         l_elem = list_entry(*head, typeof(*l_elem), list);
         r_elem = list_entry(*tail, typeof(*r_elem), list);
-        if (cmp(l_elem->value, r_elem->value))
+        if (key_after(l_elem->prefix, l_elem->value, r_elem->prefix,
+                      r_elem->value, descend))
             qnode_move_after(*head, *tail);
         return 2;
     }
@@ -317,11 +381,13 @@ static int q_sort_interval(struct list_head **head,
         r = r->next;
 
     /* Sort two sub-queues respectively. */
-    l_num = q_sort_interval(head, &r->prev, cmp);
+    l_num = descend ? q_sort_descend(head, &r->prev)
+                    : q_sort_ascend(head, &r->prev);
     l = *head;
     l_tail = r->prev;
 
-    r_num = q_sort_interval(&l_tail->next, tail, cmp);
+    r_num = descend ? q_sort_descend(&l_tail->next, tail)
+                    : q_sort_ascend(&l_tail->next, tail);
     r = l_tail->next;
 
     ret_num = l_num + r_num;
@@ -329,7 +395,8 @@ static int q_sort_interval(struct list_head **head,
     /* Find the new head for the sorted queue after merging. */
     l_elem = list_entry(l, typeof(*l_elem), list);
     r_elem = list_entry(r, typeof(*r_elem), list);
-    if (cmp(l_elem->value, r_elem->value))
+    if (key_after(l_elem->prefix, l_elem->value, r_elem->prefix,
+                  r_elem->value, descend))
         *head = r;
 
     /* Merge two sub-queues into one queue.*/
@@ -351,7 +418,8 @@ static int q_sort_interval(struct list_head **head,
         l_elem = list_entry(l, typeof(*l_elem), list);
         r_elem = list_entry(r, typeof(*r_elem), list);
 
-        if (cmp(l_elem->value, r_elem->value)) {
+        if (key_after(l_elem->prefix, l_elem->value, r_elem->prefix,
+                      r_elem->value, descend)) {
             temp = r->next;
             qnode_move_before(r, l);
             if (r_num) {
@@ -368,15 +436,26 @@ static int q_sort_interval(struct list_head **head,
     return ret_num;
 }
 
+static int q_sort_ascend(struct list_head **head, struct list_head **tail)
+{
+    return q_sort_interval(head, tail, false);
+}
+
+static int q_sort_descend(struct list_head **head, struct list_head **tail)
+{
+    return q_sort_interval(head, tail, true);
+}
+
 /* Sort elements of queue in ascending/descending order */
 void q_sort(struct list_head *head, bool descend)
 {
-    bool (*cmp[2])(const char *, const char *) = {cmp_ascend, cmp_descend};
-
     if (!head || q_is_empty(head))
         return;
 
-    q_sort_interval(&head->next, &head->prev, cmp[descend]);
+    if (descend)
+        q_sort_descend(&head->next, &head->prev);
+    else
+        q_sort_ascend(&head->next, &head->prev);
 }
 
 /* Remove every node which has a node with a strictly less value anywhere to
@@ -398,7 +477,8 @@ int q_ascend(struct list_head *head)
         for (iter = curr_elem->list.next, safe = iter->next; iter != head;
              iter = safe, safe = safe->next) {
             iter_elem = list_entry(iter, typeof(*iter_elem), list);
-            if (strcmp(curr_elem->value, iter_elem->value) > 0) {
+            if (key_cmp(curr_elem->prefix, curr_elem->value, iter_elem->prefix,
+                        iter_elem->value) > 0) {
                 list_del(iter);
                 free(iter_elem->value);
                 free(iter_elem);
@@ -430,7 +510,8 @@ int q_descend(struct list_head *head)
         for (iter = curr_elem->list.prev, safe = iter->prev; iter != head;
              iter = safe, safe = safe->prev) {
             iter_elem = list_entry(iter, typeof(*iter_elem), list);
-            if (strcmp(curr_elem->value, iter_elem->value) > 0) {
+            if (key_cmp(curr_elem->prefix, curr_elem->value, iter_elem->prefix,
+                        iter_elem->value) > 0) {
                 list_del(iter);
                 free(iter_elem->value);
                 free(iter_elem);
@@ -446,8 +527,6 @@ int q_descend(struct list_head *head)
 int q_merge(struct list_head *head, bool descend)
 {
     // https://leetcode.com/problems/merge-k-sorted-lists/
-    bool (*cmp[2])(const char *, const char *) = {cmp_ascend, cmp_descend};
-
     queue_contex_t *q1_contex, *q2_contex;
     element_t *q1_curr_elem, *q2_curr_elem;
     struct list_head *q1_chain, *q2_chain, *q1_curr, *q2_curr, *temp;
@@ -482,7 +561,8 @@ int q_merge(struct list_head *head, bool descend)
             q1_curr_elem = list_entry(q1_curr, typeof(*q1_curr_elem), list);
             q2_curr_elem = list_entry(q2_curr, typeof(*q2_curr_elem), list);
 
-            if (cmp[!descend](q1_curr_elem->value, q2_curr_elem->value))
+            if (key_after(q2_curr_elem->prefix, q2_curr_elem->value,
+                          q1_curr_elem->prefix, q1_curr_elem->value, descend))
                 q1_curr = q1_curr->next;
             else {
                 temp = q2_curr->next;
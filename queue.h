@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
@@ -16,12 +17,16 @@
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
+ * @prefix: first 8 bytes of @value as big-endian integer, zero padded
  * @list: node of a doubly-linked list
  *
- * @value needs to be explicitly allocated and freed
+ * @value needs to be explicitly allocated and freed.  @prefix has to be set
+ * whenever @value is, for comparisons to decide from the node alone whenever
+ * the strings differ early on.
  */
 typedef struct {
     char *value;
+    uint64_t prefix;
     struct list_head list;
 } element_t;
 
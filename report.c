@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -96,7 +97,6 @@ void report_event(message_t msg, char *fmt, ...)
 }
 
 #define BUF_SIZE 4096
-extern int web_connfd;
 void report(int level, char *fmt, ...)
 {
     if (!verbfile)
@@ -118,15 +118,15 @@ void report(int level, char *fmt, ...)
             fflush(logfile);
             va_end(ap);
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
-    }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
+        if (web_connfd) {
+            va_start(ap, fmt);
+            vsnprintf(buffer, BUF_SIZE - 1, fmt, ap);
+            va_end(ap);
+            int len = strlen(buffer);
+            buffer[len] = '\n';
+            buffer[len + 1] = '\0';
+            web_send(web_connfd, buffer);
+        }
     }
 }
 
@@ -149,13 +149,42 @@ void report_noreturn(int level, char *fmt, ...)
             fflush(logfile);
             va_end(ap);
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
+        if (web_connfd) {
+            va_start(ap, fmt);
+            vsnprintf(buffer, BUF_SIZE, fmt, ap);
+            va_end(ap);
+            web_send(web_connfd, buffer);
+        }
+    }
+}
+
+void report_write(int level, const char *buf, size_t len)
+{
+    if (!verbfile)
+        init_files(stdout, stdout);
+
+    if (level > verblevel)
+        return;
+
+    /* Anything formatted so far has to go out first */
+    fflush(verbfile);
+    int fd = fileno(verbfile);
+    for (size_t n = 0; n < len;) {
+        ssize_t w = write(fd, buf + n, len - n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        n += w;
     }
 
+    if (logfile) {
+        fwrite(buf, 1, len, logfile);
+        fflush(logfile);
+    }
     if (web_connfd)
-        web_send(web_connfd, buffer);
+        web_send(web_connfd, (char *) buf);
 }
 
 /* Functions denoting failures */
@@ -4,6 +4,8 @@ from __future__ import print_function
 import subprocess
 import sys
 import getopt
+import glob
+import os
 
 
 
@@ -35,7 +37,10 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-malloc",
+        19: "trace-19-replay",
+        20: "trace-20-save"
     }
 
     traceProbs = {
@@ -55,10 +60,13 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20"
     }
 
-    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 6, 6, 6]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
@@ -95,8 +103,16 @@ class Tracer:
         except Exception as e:
             self.printInColor("Call of '%s' failed: %s" % (" ".join(clist), e), self.RED)
             return False
+        finally:
+            self.removeScratch(tid)
         return retcode == 0
 
+    # Traces keep the files they write in traces/.<trace name>.*
+    def removeScratch(self, tid):
+        pattern = "%s/.%s.*" % (self.traceDirectory, self.traceDict[tid])
+        for f in glob.glob(pattern):
+            os.remove(f)
+
     def run(self, tid=0):
         scoreDict = {k: 0 for k in self.traceDict.keys()}
         print("---\tTrace\t\tPoints")
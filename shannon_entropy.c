@@ -8,23 +8,91 @@
 /* Shannon full integer entropy calculation */
 #define BUCKET_SIZE (1 << 8)
 
-double shannon_entropy(const uint8_t *s)
+/* Consecutive bytes are counted in separate histograms, so that a run of the
+ * same byte does not make every increment wait for the previous one.
+ */
+#define HISTOGRAMS 4
+
+/* Count byte c in histogram h, and list it the first time h sees it */
+#define COUNT(h, c)                     \
+    do {                                \
+        if (!bucket[h][c]++)            \
+            distinct[n_distinct++] = c; \
+    } while (0)
+
+/* Entropy of string s, adding its byte counts to total if not NULL */
+double shannon_entropy_add(const uint8_t *s, uint64_t *total)
 {
     assert(s);
-    const uint64_t count = strlen((char *) s);
     uint64_t entropy_sum = 0;
     const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
 
-    uint32_t bucket[BUCKET_SIZE];
+    uint32_t bucket[HISTOGRAMS][BUCKET_SIZE];
+    uint8_t distinct[HISTOGRAMS * BUCKET_SIZE];
+    size_t n_distinct = 0;
     memset(&bucket, 0, sizeof(bucket));
 
-    for (uint32_t i = 0; i < count; i++)
-        bucket[s[i]]++;
+    /* Find the end of the string while counting its bytes */
+    const uint8_t *end = s;
+    for (;; end += HISTOGRAMS) {
+        if (!end[0])
+            break;
+        COUNT(0, end[0]);
+        if (!end[1]) {
+            end += 1;
+            break;
+        }
+        COUNT(1, end[1]);
+        if (!end[2]) {
+            end += 2;
+            break;
+        }
+        COUNT(2, end[2]);
+        if (!end[3]) {
+            end += 3;
+            break;
+        }
+        COUNT(3, end[3]);
+    }
+    const uint64_t count = end - s;
 
+    /* Only visit the bytes present, each once: clearing their counts skips
+     * the copies listed by other histograms.
+     */
+    for (size_t i = 0; i < n_distinct; i++) {
+        uint8_t c = distinct[i];
+        uint64_t p = bucket[0][c] + bucket[1][c] + bucket[2][c] + bucket[3][c];
+        if (p) {
+            bucket[0][c] = bucket[1][c] = bucket[2][c] = bucket[3][c] = 0;
+            if (total)
+                total[c] += p;
+            p *= LOG2_ARG_SHIFT / count;
+            entropy_sum += -p * log2_lshift16(p);
+        }
+    }
+
+    entropy_sum /= LOG2_ARG_SHIFT;
+    return entropy_sum * 100.0 / entropy_max;
+}
+
+double shannon_entropy(const uint8_t *s)
+{
+    return shannon_entropy_add(s, NULL);
+}
+
+/* Entropy of count bytes distributed as in bucket.  The probabilities keep
+ * 16 fractional bits however large count is.
+ */
+double shannon_entropy_histogram(const uint64_t *bucket, uint64_t count)
+{
+    uint64_t entropy_sum = 0;
+    const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
+
+    if (!count)
+        return 0.0;
     for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
         if (bucket[i]) {
-            uint64_t p = bucket[i];
-            p *= LOG2_ARG_SHIFT / count;
+            uint64_t p = (bucket[i] * LOG2_ARG_SHIFT) / count;
             entropy_sum += -p * log2_lshift16(p);
         }
     }
@@ -9,7 +9,6 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
-#include <mqueue.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -46,6 +45,9 @@
 /* Analyze all literal strings instead of print statements */
 #define OPT_PARSE_STRINGS (0x00000040)
 
+/* Reuse the findings of the last run for the files which did not change */
+#define OPT_INCREMENTAL (0x00000080)
+
 #define PARSER_OK (0)
 #define PARSER_COMMENT_FOUND (1)
 #define PARSER_EOF (256)
@@ -55,6 +57,12 @@
 #define TABLE_SIZE (4 * 16384)
 #define HASH_MASK (TABLE_SIZE - 1)
 
+/* Locks guarding slices of the bad spellings table, must be a power of 2 */
+#define SPELLING_LOCKS (64)
+
+#define MAX_WORKERS (64)
+#define FILES_PER_BATCH (8)
+
 #define MAX_WORD_NODES (27) /* a..z -> 0..25 and _/0..9 as 26 */
 #define WORD_NODES_HEAP_SIZE (250000)
 #define PRINTK_NODES_HEAP_SIZE (12000)
@@ -79,6 +87,19 @@ static const char *dictionary_paths[] = {
     "/usr/share/dict/american-english",
     "scripts/aspell-pws",
 };
+#define DICTIONARIES ARRAY_SIZE(dictionary_paths)
+
+/* Trie built from the dictionaries, saved by the first run to be mapped by the
+ * next ones.
+ */
+#define DICT_CACHE_PATH ".fmtscan.dict"
+#define DICT_CACHE_MAGIC (0x6869636e61637366ULL) /* "fscachih" */
+#define DICT_CACHE_VERSION (2)
+
+/* Findings per file, kept by incremental runs. */
+#define INDEX_PATH ".fmtscan.index"
+#define INDEX_MAGIC (0x7865646e69736621ULL) /* "!fsindex" */
+#define INDEX_VERSION (2)
 
 /* token types used for parsing C source code */
 typedef enum {
@@ -120,18 +141,6 @@ typedef void (*parse_func_t)(const char *restrict path,
 
 typedef uint16_t get_char_t;
 
-typedef struct {
-    void *data;
-    size_t size;
-    parse_func_t parse_func;
-    char filename[PATH_MAX];
-} msg_t;
-
-typedef struct {
-    char *path;
-    mqd_t mq;
-} context_t;
-
 /* Parser state context. */
 typedef struct {
     unsigned char *ptr;      /* current data position */
@@ -165,10 +174,86 @@ typedef struct word_node {
     bool eow; /* Flag indicating the end of a word */
 } word_node_t;
 
+/* What a dictionary file looked like when the cache was built from it. */
+typedef struct {
+    char path[128];
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t ino;
+} dict_stamp_t;
+
+/* What the fmtscan binary looked like when it wrote a cache. Another build
+ * may lay out or fill the cache differently, so it only trusts its own.
+ */
+typedef struct {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t ino;
+} build_stamp_t;
+
+/* Header of the dictionary cache file, the trie nodes follow it. */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t node_size; /* sizeof(word_node_t) of the writer */
+    uint32_t nodes;
+    uint32_t words;
+    uint32_t dict_size;
+    build_stamp_t build;
+    dict_stamp_t stamps[DICTIONARIES];
+} ALIGNED(64) dict_cache_t;
+
+/* Record of one file in the index, followed by its path and the bad spellings
+ * found in it, both NUL terminated.
+ */
+typedef struct {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t hash;      /* hash_content64() of the contents */
+    uint32_t lines;     /* lines counted by the parser */
+    uint32_t nwords;    /* bad spellings, repeats included */
+    uint32_t path_len;  /* including the NUL */
+    uint32_t words_len; /* bytes of all the words, NULs included */
+} file_stamp_t;
+
+/* Header of the index file. */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags; /* opt_flags the findings were made with */
+    uint32_t entries;
+    uint64_t hash; /* hash_content64() of the records */
+    build_stamp_t build;
+    dict_stamp_t dicts[DICTIONARIES];
+} ALIGNED(64) index_header_t;
+
+/* Findings for one file, from the index of the last run or from this run. */
+typedef struct file_result {
+    file_stamp_t stamp;
+    const char *path;
+    const char *words;        /* stamp.nwords NUL terminated strings */
+    char *buf;                /* words found by this run */
+    size_t buf_size;
+    struct file_result *next; /* in index_table */
+} file_result_t;
+
+/* Files gathered by the directory walk, parsed later by the workers. */
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t size;
+    size_t next;            /* first file not yet taken by a worker */
+    file_result_t *results; /* findings per file, in incremental mode */
+} file_list_t;
+
 static uint64_t bytes_total;
 static uint32_t files;
-static uint32_t lines;
-static uint32_t lineno;
+static uint32_t lines_total;
+static __thread uint32_t lines;
+static __thread uint32_t lineno;
 static uint32_t bad_spellings;
 static uint32_t bad_spellings_total;
 static uint32_t words;
@@ -182,8 +267,11 @@ static char space[] = " ";
 static bool is_not_whitespace[256] ALIGNED(64);
 static bool is_not_identifier[256] ALIGNED(64);
 
-/* Flat array representing the dictionary words tree. */
+/* Flat array representing the dictionary words tree. The lookups go through
+ * word_heap, which points to the cache file instead when one could be mapped.
+ */
 static word_node_t word_node_heap[WORD_NODES_HEAP_SIZE];
+static word_node_t *word_heap = word_node_heap;
 static word_node_t *word_nodes = &word_node_heap[0];
 static word_node_t *word_node_heap_next = &word_node_heap[1];
 
@@ -192,8 +280,25 @@ static word_node_t printf_node_heap[PRINTK_NODES_HEAP_SIZE];
 static word_node_t *printf_nodes = &printf_node_heap[0];
 static word_node_t *printf_node_heap_next = &printf_node_heap[1];
 
-/* Hash table storing misspelled words. */
+/* Hash table storing misspelled words, shared by all the workers. */
 static hash_entry_t *hash_bad_spellings[TABLE_SIZE];
+static pthread_mutex_t spelling_locks[SPELLING_LOCKS];
+
+static file_list_t file_list;
+
+/* Dictionaries the words are checked against, as they are now. */
+static dict_stamp_t dict_stamps[DICTIONARIES];
+static build_stamp_t build_stamp;
+static bool build_stamped;
+
+/* Index of the last incremental run, looked up by path. */
+static file_result_t *index_table[TABLE_SIZE];
+static file_result_t *index_entries;
+static void *index_map;
+static size_t index_map_size;
+
+/* Where a worker records the bad spellings of the file it parses. */
+static __thread file_result_t *collect;
 
 /* printf format specifiers. */
 static format_t formats[] ALIGNED(64) = {
@@ -287,7 +392,32 @@ static uint32_t stress_hash_mulxror64(const char *str, const size_t len)
     return (uint32_t) ((hash >> 32) ^ hash) & HASH_MASK;
 }
 
-static int parse_file(char *restrict path, const mqd_t mq);
+/* 64-bit hash telling whether the contents of a file changed. Every step is
+ * invertible, so unlike stress_hash_mulxror64() a zero word in the input does
+ * not wipe out what was hashed before it.
+ */
+static uint64_t hash_content64(const uint8_t *data, const size_t len)
+{
+    uint64_t hash = len * 0x9e3779b97f4a7c15ULL;
+
+    for (size_t i = len >> 3; i; i--) {
+        uint64_t v;
+
+        memcpy(&v, data, sizeof(v));
+        data += sizeof(v);
+        hash ^= v;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    for (size_t i = len & 7; i; i--) {
+        hash ^= *data++;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+static int parse_file(char *restrict path);
 
 static void out_of_memory(void)
 {
@@ -396,17 +526,204 @@ static inline int read_dictionary(const char *dictfile)
     return 0;
 }
 
+/* Fill @stamps with what the dictionaries look like now. */
+static int dict_stamp(dict_stamp_t *stamps)
+{
+    memset(stamps, 0, sizeof(dict_stamp_t) * DICTIONARIES);
+    for (size_t i = 0; i < DICTIONARIES; i++) {
+        struct stat buf;
+
+        if (stat(dictionary_paths[i], &buf) < 0)
+            return -1;
+        snprintf(stamps[i].path, sizeof(stamps[i].path), "%s",
+                 dictionary_paths[i]);
+        stamps[i].mtime_sec = buf.st_mtim.tv_sec;
+        stamps[i].mtime_nsec = buf.st_mtim.tv_nsec;
+        stamps[i].size = buf.st_size;
+        stamps[i].ino = buf.st_ino;
+    }
+    return 0;
+}
+
+/* Fill @stamp with what this binary looks like. */
+static int build_stamp_get(build_stamp_t *stamp)
+{
+    struct stat buf;
+
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat("/proc/self/exe", &buf) < 0)
+        return -1;
+    stamp->mtime_sec = buf.st_mtim.tv_sec;
+    stamp->mtime_nsec = buf.st_mtim.tv_nsec;
+    stamp->size = buf.st_size;
+    stamp->ino = buf.st_ino;
+    return 0;
+}
+
+/* Check that every link of the trie stays within its @count nodes, so that a
+ * damaged cache cannot send find_word() astray.
+ */
+static bool dict_nodes_valid(const word_node_t *nodes, uint32_t count)
+{
+    uint32_t bad = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t eow;
+
+        for (size_t j = 0; j < MAX_WORD_NODES; j++)
+            bad |= nodes[i].word_node_index[j].lo32 >= count;
+        memcpy(&eow, &nodes[i].eow, sizeof(eow));
+        bad |= eow > 1;
+    }
+    return !bad;
+}
+
+/* Map the trie saved by an earlier run of this build, if it was built from
+ * the very same dictionaries. The nodes are used in place once checked.
+ */
+static bool load_dict_cache(const dict_stamp_t *stamps)
+{
+    struct stat buf;
+    const dict_cache_t *cache;
+
+    int fd = open(DICT_CACHE_PATH, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &buf) < 0 || (size_t) buf.st_size < sizeof(*cache)) {
+        close(fd);
+        return false;
+    }
+    cache = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache == MAP_FAILED)
+        return false;
+
+    if (cache->magic != DICT_CACHE_MAGIC ||
+        cache->version != DICT_CACHE_VERSION ||
+        cache->node_size != sizeof(word_node_t) || !cache->nodes ||
+        (size_t) buf.st_size !=
+            sizeof(*cache) + (size_t) cache->nodes * sizeof(word_node_t) ||
+        memcmp(&cache->build, &build_stamp, sizeof(cache->build)) ||
+        memcmp(cache->stamps, stamps, sizeof(cache->stamps)) ||
+        !dict_nodes_valid((const word_node_t *) (cache + 1), cache->nodes)) {
+        munmap((void *) cache, buf.st_size);
+        return false;
+    }
+
+    /* Stays mapped until exit */
+    word_nodes = word_heap = (word_node_t *) (cache + 1);
+    words = cache->words;
+    dict_size = cache->dict_size;
+    return true;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *ptr = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, ptr, len);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Save the trie for the next runs. This is best effort, a run which cannot
+ * write the cache just builds the trie again next time.
+ */
+static void save_dict_cache(const dict_stamp_t *stamps)
+{
+    dict_cache_t cache;
+    char tmp[64];
+
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = DICT_CACHE_MAGIC;
+    cache.version = DICT_CACHE_VERSION;
+    cache.node_size = sizeof(word_node_t);
+    cache.nodes = word_node_heap_next - word_node_heap;
+    cache.words = words;
+    cache.dict_size = dict_size;
+    cache.build = build_stamp;
+    memcpy(cache.stamps, stamps, sizeof(cache.stamps));
+
+    /* Written aside and renamed so concurrent runs never map half a file */
+    snprintf(tmp, sizeof(tmp), "%s.%d", DICT_CACHE_PATH, getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR |
+                                                        S_IRGRP | S_IROTH);
+    if (fd < 0)
+        return;
+    if (write_all(fd, &cache, sizeof(cache)) < 0 ||
+        write_all(fd, word_node_heap, cache.nodes * sizeof(word_node_t)) < 0 ||
+        close(fd) < 0 || rename(tmp, DICT_CACHE_PATH) < 0) {
+        close(fd);
+        unlink(tmp);
+    }
+}
+
+static int load_dictionaries(void)
+{
+    if (dict_stamp(dict_stamps) < 0)
+        return -1;
+    /* Without a way to tell builds apart, no cache is trusted */
+    build_stamped = build_stamp_get(&build_stamp) == 0;
+    if (build_stamped && load_dict_cache(dict_stamps))
+        return 0;
+
+    for (size_t i = 0; i < DICTIONARIES; i++) {
+        if (read_dictionary(dictionary_paths[i]) < 0)
+            return -1;
+    }
+    if (build_stamped)
+        save_dict_cache(dict_stamps);
+    return 0;
+}
+
+/* Note a bad spelling in the findings of the file being parsed. */
+static void result_add_word(file_result_t *res, const char *word, size_t len)
+{
+    if (res->stamp.words_len + len > res->buf_size) {
+        size_t size = res->buf_size ? res->buf_size * 2 : 256;
+
+        while (size < res->stamp.words_len + len)
+            size *= 2;
+        res->buf = realloc(res->buf, size);
+        if (UNLIKELY(!res->buf))
+            out_of_memory();
+        res->buf_size = size;
+    }
+    memcpy(res->buf + res->stamp.words_len, word, len);
+    res->stamp.words_len += len;
+    res->stamp.nwords++;
+    res->words = res->buf;
+}
+
 static inline void add_bad_spelling(const char *word, const size_t len)
 {
     if (find_word(word, printf_nodes, printf_node_heap))
         return;
 
-    bad_spellings_total++;
-    hash_entry_t **head = &hash_bad_spellings[stress_hash_mulxror64(word, len)];
+    __atomic_fetch_add(&bad_spellings_total, 1, __ATOMIC_RELAXED);
+    if (collect)
+        result_add_word(collect, word, len);
+
+    const uint32_t h = stress_hash_mulxror64(word, len);
+    pthread_mutex_t *lock = &spelling_locks[h & (SPELLING_LOCKS - 1)];
+    hash_entry_t **head = &hash_bad_spellings[h];
     hash_entry_t *he;
+
+    pthread_mutex_lock(lock);
     for (he = *head; he; he = he->next) {
-        if (!strcmp(he->token, word))
+        if (!strcmp(he->token, word)) {
+            pthread_mutex_unlock(lock);
             return;
+        }
     }
     he = malloc(sizeof(*he) + len);
     if (UNLIKELY(!he))
@@ -415,7 +732,8 @@ static inline void add_bad_spelling(const char *word, const size_t len)
     he->next = *head;
     *head = he;
     memcpy(he->token, word, len);
-    bad_spellings++;
+    pthread_mutex_unlock(lock);
+    __atomic_fetch_add(&bad_spellings, 1, __ATOMIC_RELAXED);
 }
 
 static void check_words(token_t *token)
@@ -435,7 +753,7 @@ static void check_words(token_t *token)
         *p2 = '\0';
 
         if (LIKELY(p2 - p1 > 1)) {
-            if (!find_word(p1, word_nodes, word_node_heap))
+            if (!find_word(p1, word_nodes, word_heap))
                 add_bad_spelling(p1, 1 + p2 - p1);
         }
         p1 = p2 + 1;
@@ -1448,7 +1766,206 @@ static void parse_literal_strings(const char *restrict path UNUSED,
     }
 }
 
-static int parse_dir(char *restrict path, const mqd_t mq)
+static void file_list_add(const char *path)
+{
+    if (file_list.count == file_list.size) {
+        size_t size = file_list.size ? file_list.size * 2 : 1024;
+        char **paths = realloc(file_list.paths, size * sizeof(char *));
+
+        if (UNLIKELY(!paths))
+            out_of_memory();
+        file_list.paths = paths;
+        file_list.size = size;
+    }
+    char *copy = strdup(path);
+    if (UNLIKELY(!copy))
+        out_of_memory();
+    file_list.paths[file_list.count++] = copy;
+}
+
+static void file_list_free(void)
+{
+    for (size_t i = 0; i < file_list.count; i++)
+        free(file_list.paths[i]);
+    free(file_list.paths);
+    memset(&file_list, 0, sizeof(file_list));
+}
+
+static file_result_t *index_find(const char *path)
+{
+    size_t len = strlen(path);
+    file_result_t *res = index_table[stress_hash_mulxror64(path, len)];
+
+    for (; res; res = res->next) {
+        if (res->stamp.path_len == len + 1 && !memcmp(res->path, path, len))
+            return res;
+    }
+    return NULL;
+}
+
+/* Map the index of the last incremental run. It is ignored unless made by
+ * this build with the same options and dictionaries as this run.
+ */
+static void index_load(void)
+{
+    struct stat buf;
+    const index_header_t *hdr;
+
+    int fd = open(INDEX_PATH, O_RDONLY);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &buf) < 0 || (size_t) buf.st_size < sizeof(*hdr)) {
+        close(fd);
+        return;
+    }
+    hdr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd,
+               0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        return;
+    index_map = (void *) hdr;
+    index_map_size = buf.st_size;
+
+    if (hdr->magic != INDEX_MAGIC || hdr->version != INDEX_VERSION ||
+        hdr->flags != (opt_flags & ~OPT_INCREMENTAL) ||
+        memcmp(&hdr->build, &build_stamp, sizeof(hdr->build)) ||
+        memcmp(hdr->dicts, dict_stamps, sizeof(hdr->dicts)) ||
+        hdr->hash != hash_content64((const uint8_t *) (hdr + 1),
+                                    buf.st_size - sizeof(*hdr)))
+        return;
+
+    index_entries = calloc(hdr->entries, sizeof(file_result_t));
+    if (UNLIKELY(hdr->entries && !index_entries))
+        out_of_memory();
+
+    const char *ptr = (const char *) (hdr + 1);
+    const char *end = (const char *) hdr + buf.st_size;
+
+    for (uint32_t i = 0; i < hdr->entries; i++) {
+        file_result_t *res = &index_entries[i];
+
+        if ((size_t) (end - ptr) < sizeof(res->stamp))
+            break;
+        memcpy(&res->stamp, ptr, sizeof(res->stamp));
+        ptr += sizeof(res->stamp);
+
+        /* A truncated or garbled record ends the index */
+        const file_stamp_t *st = &res->stamp;
+        if ((size_t) (end - ptr) < (size_t) st->path_len + st->words_len ||
+            !st->path_len || ptr[st->path_len - 1] ||
+            (st->words_len && ptr[st->path_len + st->words_len - 1]))
+            break;
+        res->path = ptr;
+        res->words = ptr + st->path_len;
+        ptr += st->path_len + st->words_len;
+
+        uint32_t nwords = 0;
+        for (const char *w = res->words; w < ptr; w++)
+            nwords += !*w;
+        if (nwords != st->nwords)
+            break;
+
+        file_result_t **head =
+            &index_table[stress_hash_mulxror64(res->path, st->path_len - 1)];
+        res->next = *head;
+        *head = res;
+    }
+}
+
+/* Save the findings of this run for the next one, through a rename like the
+ * dictionary cache.
+ */
+static void index_save(void)
+{
+    index_header_t hdr;
+    char tmp[64];
+    size_t size = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = INDEX_MAGIC;
+    hdr.version = INDEX_VERSION;
+    hdr.flags = opt_flags & ~OPT_INCREMENTAL;
+    hdr.build = build_stamp;
+    memcpy(hdr.dicts, dict_stamps, sizeof(hdr.dicts));
+    for (size_t i = 0; i < file_list.count; i++) {
+        const file_result_t *res = &file_list.results[i];
+
+        if (!res->path)
+            continue;
+        hdr.entries++;
+        size += sizeof(res->stamp) + res->stamp.path_len + res->stamp.words_len;
+    }
+
+    /* Records are put together first, the header covers them with a hash */
+    char *body = malloc(size ? size : 1);
+    if (UNLIKELY(!body))
+        out_of_memory();
+
+    char *ptr = body;
+    for (size_t i = 0; i < file_list.count; i++) {
+        const file_result_t *res = &file_list.results[i];
+
+        if (!res->path)
+            continue;
+        memcpy(ptr, &res->stamp, sizeof(res->stamp));
+        ptr += sizeof(res->stamp);
+        memcpy(ptr, res->path, res->stamp.path_len);
+        ptr += res->stamp.path_len;
+        if (res->stamp.words_len)
+            memcpy(ptr, res->words, res->stamp.words_len);
+        ptr += res->stamp.words_len;
+    }
+    hdr.hash = hash_content64((const uint8_t *) body, size);
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", INDEX_PATH, getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR |
+                                                        S_IRGRP | S_IROTH);
+    if (fd >= 0) {
+        if (write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+            write_all(fd, body, size) < 0 || close(fd) < 0 ||
+            rename(tmp, INDEX_PATH) < 0) {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+    free(body);
+}
+
+static void index_free(void)
+{
+    if (file_list.results) {
+        for (size_t i = 0; i < file_list.count; i++)
+            free(file_list.results[i].buf);
+        free(file_list.results);
+        file_list.results = NULL;
+    }
+    free(index_entries);
+    index_entries = NULL;
+    memset(index_table, 0, sizeof(index_table));
+    if (index_map)
+        munmap(index_map, index_map_size);
+    index_map = NULL;
+}
+
+/* Count the findings of an unchanged file again, as if it had been parsed. */
+static void result_replay(file_result_t *restrict res,
+                          const file_result_t *restrict old)
+{
+    const char *word = old->words;
+
+    res->stamp = old->stamp;
+    res->path = old->path;
+    res->words = old->words;
+    lines += old->stamp.lines;
+    for (uint32_t i = 0; i < old->stamp.nwords; i++) {
+        size_t len = strlen(word) + 1;
+
+        add_bad_spelling(word, len);
+        word += len;
+    }
+}
+
+static int parse_dir(char *restrict path)
 {
     DIR *dp;
     struct dirent *d;
@@ -1482,7 +1999,7 @@ static int parse_dir(char *restrict path, const mqd_t mq)
             /* Don't follow symlinks */
             if (S_ISLNK(buf.st_mode))
                 continue;
-            parse_file(filepath, mq);
+            parse_file(filepath);
         }
     }
     closedir(dp);
@@ -1490,29 +2007,17 @@ static int parse_dir(char *restrict path, const mqd_t mq)
     return 0;
 }
 
-static int parse_file(char *restrict path, const mqd_t mq)
+/* Walk @path and queue the C sources found for the workers. */
+static int parse_file(char *restrict path)
 {
     struct stat buf;
-    int fd;
     int rc = 0;
 
-    const parse_func_t parse_func = (opt_flags & OPT_PARSE_STRINGS)
-                                        ? parse_literal_strings
-                                        : parse_messages;
-
-    fd = open(path, O_RDONLY | O_NOATIME);
-    if (UNLIKELY(fd < 0)) {
-        fprintf(stderr, "Cannot open %s, errno=%d (%s)\n", path, errno,
-                strerror(errno));
-        return -1;
-    }
-    if (UNLIKELY(fstat(fd, &buf) < 0)) {
+    if (UNLIKELY(stat(path, &buf) < 0)) {
         fprintf(stderr, "Cannot stat %s, errno=%d (%s)\n", path, errno,
                 strerror(errno));
-        close(fd);
         return -1;
     }
-    lineno = 0;
 
     if (LIKELY(S_ISREG(buf.st_mode))) {
         size_t len = strlen(path);
@@ -1520,101 +2025,166 @@ static int parse_file(char *restrict path, const mqd_t mq)
         if (LIKELY(((len >= 2) && !strcmp(path + len - 2, ".c")) ||
                    ((len >= 2) && !strcmp(path + len - 2, ".h")) ||
                    ((len >= 4) && !strcmp(path + len - 4, ".cpp")))) {
-            if (LIKELY(buf.st_size > 0)) {
-                msg_t msg;
-
-                msg.data = mmap(NULL, (size_t) buf.st_size, PROT_READ,
-                                MAP_PRIVATE | MAP_POPULATE, fd, 0);
-                if (UNLIKELY(msg.data == MAP_FAILED)) {
-                    close(fd);
-                    fprintf(stderr, "Cannot mmap %s, errno=%d (%s)\n", path,
-                            errno, strerror(errno));
-                    return -1;
-                }
-                bytes_total += buf.st_size;
-
-                msg.parse_func = parse_func;
-                msg.size = buf.st_size;
-                strncpy(msg.filename, path, sizeof(msg.filename) - 1);
-                mq_send(mq, (char *) &msg, sizeof(msg), 1);
-            }
+            if (LIKELY(buf.st_size > 0))
+                file_list_add(path);
             files++;
         }
-        close(fd);
-    } else {
-        close(fd);
-        if (S_ISDIR(buf.st_mode))
-            rc = parse_dir(path, mq);
+    } else if (S_ISDIR(buf.st_mode)) {
+        rc = parse_dir(path);
     }
     return rc;
 }
 
-
-static void *reader(void *arg)
+/* Map one file and run the parser over it with the caller's tokens. In
+ * incremental mode the findings go to @res, and those of the last run are
+ * reused if the file did not change since.
+ */
+static int scan_file(const char *restrict path,
+                     const parse_func_t parse_func,
+                     file_result_t *restrict res,
+                     token_t *restrict t,
+                     token_t *restrict line,
+                     token_t *restrict str)
 {
-    static void *nowt = NULL;
-    const context_t *ctxt = arg;
-    msg_t msg = {NULL, 0, NULL, ""};
+    struct stat buf;
+    void *data;
+    int fd;
 
-    parse_file(ctxt->path, ctxt->mq);
-    mq_send(ctxt->mq, (char *) &msg, sizeof(msg), 1);
+    fd = open(path, O_RDONLY | O_NOATIME);
+    if (UNLIKELY(fd < 0)) {
+        fprintf(stderr, "Cannot open %s, errno=%d (%s)\n", path, errno,
+                strerror(errno));
+        return -1;
+    }
+    if (UNLIKELY(fstat(fd, &buf) < 0)) {
+        fprintf(stderr, "Cannot stat %s, errno=%d (%s)\n", path, errno,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+    /* Emptied since the walk */
+    if (UNLIKELY(buf.st_size <= 0)) {
+        close(fd);
+        return 0;
+    }
+
+    const file_result_t *old = res ? index_find(path) : NULL;
+    if (old && old->stamp.size == buf.st_size &&
+        old->stamp.mtime_sec == buf.st_mtim.tv_sec &&
+        old->stamp.mtime_nsec == buf.st_mtim.tv_nsec) {
+        close(fd);
+        __atomic_fetch_add(&bytes_total, buf.st_size, __ATOMIC_RELAXED);
+        result_replay(res, old);
+        return 0;
+    }
+
+    data = mmap(NULL, (size_t) buf.st_size, PROT_READ,
+                MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (UNLIKELY(data == MAP_FAILED)) {
+        fprintf(stderr, "Cannot mmap %s, errno=%d (%s)\n", path, errno,
+                strerror(errno));
+        return -1;
+    }
+    __atomic_fetch_add(&bytes_total, buf.st_size, __ATOMIC_RELAXED);
+
+    if (res) {
+        /* Touched but not changed, e.g. by a checkout */
+        uint64_t hash = hash_content64(data, (size_t) buf.st_size);
+
+        if (old && old->stamp.size == buf.st_size && old->stamp.hash == hash) {
+            result_replay(res, old);
+        } else {
+            uint32_t lines_before = lines;
+
+            res->stamp.path_len = strlen(path) + 1;
+            collect = res;
+            lineno = 0;
+            parse_func(path, data, (uint8_t *) data + buf.st_size, t, line,
+                       str);
+            collect = NULL;
+            res->stamp.lines = lines - lines_before;
+        }
+        res->path = path;
+        res->stamp.hash = hash;
+        res->stamp.size = buf.st_size;
+        res->stamp.mtime_sec = buf.st_mtim.tv_sec;
+        res->stamp.mtime_nsec = buf.st_mtim.tv_nsec;
+    } else {
+        lineno = 0;
+        parse_func(path, data, (uint8_t *) data + buf.st_size, t, line, str);
+    }
+    munmap(data, (size_t) buf.st_size);
 
-    return &nowt;
+    return 0;
 }
 
-static int parse_path(char *path,
-                      token_t *restrict t,
-                      token_t *restrict line,
-                      token_t *restrict str)
+/* Take batches of files off the list until it runs dry. Every worker has
+ * tokens of its own, only the bad spellings table is shared.
+ */
+static void *scan_worker(void *arg UNUSED)
 {
-    mqd_t mq = -1;
-    struct mq_attr attr;
-    char mq_name[64];
-    int rc;
-    context_t ctxt;
-    pthread_t pthread;
+    token_t t, line, str;
 
-    snprintf(mq_name, sizeof(mq_name), "/fmtscan-%i", getpid());
+    const parse_func_t parse_func = (opt_flags & OPT_PARSE_STRINGS)
+                                        ? parse_literal_strings
+                                        : parse_messages;
 
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 10;
-    attr.mq_msgsize = sizeof(msg_t);
-    attr.mq_curmsgs = 0;
+    token_new(&t);
+    token_new(&line);
+    token_new(&str);
 
-    mq = mq_open(mq_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
-    if (mq < 0)
-        return -1;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&file_list.next, FILES_PER_BATCH,
+                                      __ATOMIC_RELAXED);
+        if (i >= file_list.count)
+            break;
 
-    ctxt.path = path;
-    ctxt.mq = mq;
+        size_t end = i + FILES_PER_BATCH;
+        if (end > file_list.count)
+            end = file_list.count;
+        for (; i < end; i++) {
+            file_result_t *res =
+                file_list.results ? &file_list.results[i] : NULL;
 
-    rc = pthread_create(&pthread, NULL, reader, &ctxt);
-    if (rc) {
-        rc = -1;
-        goto err;
+            scan_file(file_list.paths[i], parse_func, res, &t, &line, &str);
+        }
     }
 
-    for (;;) {
-        msg_t msg;
+    token_free(&str);
+    token_free(&line);
+    token_free(&t);
 
-        rc = mq_receive(mq, (char *) &msg, sizeof(msg), NULL);
-        if (UNLIKELY(rc < 0))
-            break;
-        if (UNLIKELY(msg.data == 0))
-            break;
+    __atomic_fetch_add(&lines_total, lines, __ATOMIC_RELAXED);
 
-        msg.parse_func(msg.filename, msg.data, (uint8_t *) msg.data + msg.size,
-                       t, line, str);
-        munmap(msg.data, msg.size);
-    }
+    return NULL;
+}
 
-    rc = 0;
-err:
-    pthread_join(pthread, NULL);
-    mq_close(mq);
-    mq_unlink(mq_name);
+/* Parse the files gathered so far with one worker per CPU, the calling
+ * thread being one of them.
+ */
+static void scan_files(void)
+{
+    pthread_t workers[MAX_WORKERS - 1];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n, started = 0;
+
+    n = cpus > 0 ? (size_t) cpus : 1;
+    if (n > MAX_WORKERS)
+        n = MAX_WORKERS;
+    /* No point in workers which would find nothing left to do */
+    if (n > (file_list.count + FILES_PER_BATCH - 1) / FILES_PER_BATCH)
+        n = (file_list.count + FILES_PER_BATCH - 1) / FILES_PER_BATCH;
+
+    for (; started + 1 < n; started++) {
+        /* The others take over the work of one that could not start */
+        if (pthread_create(&workers[started], NULL, scan_worker, NULL))
+            break;
+    }
+    scan_worker(NULL);
 
-    return rc;
+    for (size_t i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
 }
 
 static int cmpstr(const void *p1, const void *p2)
@@ -1691,7 +2261,6 @@ static void set_is_not_identifier(void)
 /* TODO: exclude strings in 'getopt' */
 int main(int argc, char **argv)
 {
-    token_t t, line, str;
     static char buffer[65536];
 
     token_cat = token_cat_normal;
@@ -1700,6 +2269,21 @@ int main(int argc, char **argv)
                   OPT_LITERAL_STRINGS | OPT_PARSE_STRINGS);
     opt_flags &= ~OPT_SOURCE_NAME;
 
+    int opt;
+    while ((opt = getopt(argc, argv, "i")) != -1) {
+        switch (opt) {
+        case 'i':
+            opt_flags |= OPT_INCREMENTAL;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-i] [path...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* Only bad spellings are kept in the index */
+    if (!(opt_flags & OPT_CHECK_WORDS))
+        opt_flags &= ~OPT_INCREMENTAL;
+
     set_is_not_whitespace();
     set_is_not_identifier();
 
@@ -1707,48 +2291,49 @@ int main(int argc, char **argv)
     load_printfs();
     qsort(formats, SIZEOF_ARRAY(formats), sizeof(format_t), cmp_format);
     if (opt_flags & OPT_CHECK_WORDS) {
-        int ret = 0;
-
-        for (size_t i = 0; i < ARRAY_SIZE(dictionary_paths); i++) {
-            if (read_dictionary(dictionary_paths[i]) < 0) {
-                ret = -1;
-                break;
-            }
-        }
-
-        if (ret) {
+        if (load_dictionaries() < 0) {
             fprintf(stderr, "No dictionary found.\n");
             exit(EXIT_FAILURE);
         }
+        /* The index is tied to the build like the dictionary cache */
+        if (!build_stamped)
+            opt_flags &= ~OPT_INCREMENTAL;
     }
 
-    token_new(&t);
-    token_new(&line);
-    token_new(&str);
+    for (size_t i = 0; i < SPELLING_LOCKS; i++)
+        pthread_mutex_init(&spelling_locks[i], NULL);
 
     fflush(stdout);
     setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
 
     if (argc == optind) {
-        parse_path(".", &t, &line, &str);
+        parse_file(".");
         optind++;
     } else {
         while (argc > optind) {
-            parse_path(argv[optind], &t, &line, &str);
+            parse_file(argv[optind]);
             optind++;
         }
     }
-
-    token_free(&str);
-    token_free(&line);
-    token_free(&t);
+    if (opt_flags & OPT_INCREMENTAL) {
+        index_load();
+        file_list.results = calloc(file_list.count, sizeof(file_result_t));
+        if (UNLIKELY(file_list.count && !file_list.results))
+            out_of_memory();
+    }
+    scan_files();
+    if (opt_flags & OPT_INCREMENTAL) {
+        index_save();
+        index_free();
+    }
+    file_list_free();
 
     dump_bad_spellings();
 
     printf("%" PRIu32
            " lines scanned (%.3f"
            "M bytes)\n",
-           lines, (float) bytes_total / (float) (1024 * 1024));
+           lines_total, (float) bytes_total / (float) (1024 * 1024));
     printf("%zu printf style statements being processed\n",
            SIZEOF_ARRAY(printfs));
     if (bad_spellings)
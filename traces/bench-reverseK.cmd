@@ -0,0 +1,12 @@
+# Time 'q_swap' and 'q_reverseK' on a queue of 1M nodes
+option fail 0
+option malloc 0
+new
+ih dolphin 1000000
+time swap
+time reverseK 2
+time reverseK 8
+time reverseK 64
+time reverseK 4096
+free
+quit
@@ -0,0 +1,64 @@
+# Test of deterministic malloc failures on 'q_insert_head' and 'q_insert_tail': 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', and 'q_free'
+option fail 50
+new
+# The 3rd allocation is the element of 'b'
+option malloc_nth 3
+ih a
+ih b
+ih c
+ih d
+option malloc_nth 0
+rh d
+rh c
+rh a
+size
+# Every 4th allocation is the string of 'f' and of 'h'
+option malloc_every 4
+ih e
+ih f
+ih g
+ih h
+option malloc_every 0
+rh g
+rh e
+size
+# The same seed fails the same allocations
+option malloc_seed 7
+option malloc 50
+ih s1
+ih s2
+ih s3
+ih s4
+ih s5
+ih s6
+ih s7
+ih s8
+option malloc 0
+rh s6
+rh s2
+size
+option malloc 50
+ih s1
+ih s2
+ih s3
+ih s4
+ih s5
+ih s6
+ih s7
+ih s8
+option malloc 0
+rh s6
+rh s2
+size
+# Only allocations made in 'q_insert_tail' fail
+malloc_site q_insert_tail
+ih x
+it y
+ih z
+malloc_site
+it w
+rh z
+rh x
+rh w
+size
+free
@@ -0,0 +1,37 @@
+# Test of recording and replaying a session: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', 'q_reverse', 'q_size', and 'q_free'
+option fail 0
+option malloc 0
+record traces/.trace-19-replay.bin
+new
+ih a
+ih b 3
+it c
+reverse
+rh c
+new
+it x
+it y
+record
+# The recorded session left [a b b b] and [x y]
+size
+rh x
+rh y
+free
+rh a
+rh b
+rh b
+rh b
+size
+free
+# Replaying builds the same queues again
+replay traces/.trace-19-replay.bin
+size
+rh x
+rh y
+free
+rh a
+rh b
+rh b
+rh b
+size
+free
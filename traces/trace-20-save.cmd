@@ -0,0 +1,43 @@
+# Test of saving and loading queue snapshots: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', 'q_size', and 'q_free'
+option fail 0
+option malloc 0
+new
+ih a
+ih b
+it c
+new
+it x
+it y
+save traces/.trace-20-save.snap
+free
+free
+# Loading restores both queues, with the last one current
+load traces/.trace-20-save.snap
+size
+it z
+rh x
+rh y
+rh z
+size
+free
+size
+rh b
+rh a
+rh c
+free
+# Loading onto existing queues appends to them
+new
+it w
+load traces/.trace-20-save.snap
+size
+rh x
+rh y
+free
+rh w
+size
+free
+rh b
+rh a
+rh c
+size
+free
@@ -1,14 +1,18 @@
 #ifndef TINYWEB_H
 #define TINYWEB_H
 
-#include <netinet/in.h>
+#include <stddef.h>
 
-int web_open(int port);
+/* Connection served by the command being executed, 0 if none */
+extern int web_connfd;
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr);
+int web_open(int port);
 
 void web_send(int out_fd, char *buffer);
 
 int web_eventmux(char *buf, size_t buflen);
 
+/* Answer pending request and close all connections */
+void web_close();
+
 #endif